@@ -0,0 +1,598 @@
+// EV3UARTBench.cpp
+//
+// Micro benchmarks of the library hot paths.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTBench.h"
+#include "EV3UARTSimulator.h"
+
+#if defined(EV3UART_HOST) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#ifdef EV3UART_HOST
+#include <time.h>
+#endif
+#include <math.h>
+
+// Results are written here so the decoders are not optimised away
+static volatile float bench_sink;
+static volatile int32_t bench_int_sink;
+static volatile uint8_t bench_color_sink;
+
+// Bytes parsed for each format by report()
+#ifndef BENCH_PARSE_BYTES
+#define BENCH_PARSE_BYTES 65536
+#endif
+
+// Room for the session recorded for replay() by report()
+#ifndef BENCH_CAPTURE_SIZE
+#define BENCH_CAPTURE_SIZE 4096
+#endif
+
+// Readings classify() compares the table and the float search on
+#ifndef COLOR_BENCH_READINGS
+#define COLOR_BENCH_READINGS 10000
+#endif
+
+/**
+ * Transport and timer that hand the parser a block of bytes, all readable
+ * at once, on a clock that only moves when told to
+**/
+class EV3UARTBenchLine : public EV3UARTTransport, public EV3UARTTimer {
+  public:
+    EV3UARTBenchLine() : data(NULL), size(0), pos(0), now(0) {}
+    void load(const uint8_t* bb, size_t n) { data = bb; size = n; pos = 0; }
+    void baud(uint32_t rate) {}
+    bool readable() { return pos < size; }
+    uint8_t getc() { return data[pos++]; }
+    bool writeable() { return true; }
+    void putc(uint8_t b) {}
+    uint32_t read_us() { return now; }
+    void delay_ms(uint32_t ms) { now += ms * 1000; }
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint32_t now;
+};
+
+/**
+ * The handshake of the simulated colour sensor, up to and including its
+ * ACK. Returns its length, 0 if it does not fit
+**/
+static size_t bench_handshake(uint8_t* bb, size_t max) {
+  EV3UARTSimulator sim;
+  size_t n = 0;
+  sim.advance_us(5000000);
+  while(sim.readable()) {
+    if (n == max) return 0;
+    bb[n++] = sim.getc();
+  }
+  return n;
+}
+
+/**
+ * Bring a sensor to data mode with the colour sensor handshake
+**/
+static bool bench_connect(EV3UARTSensor &sensor, EV3UARTBenchLine &line) {
+  static uint8_t handshake[SIM_BUFFER_SIZE];
+  size_t n = bench_handshake(handshake, sizeof(handshake));
+  sensor.begin(line, line);
+  line.load(handshake, n);
+  for(int i=0;i<100 && sensor.get_status() != DATA_MODE;i++) {
+    line.now += 1000;
+    sensor.check_for_data();
+  }
+  return sensor.get_status() == DATA_MODE;
+}
+
+/**
+ * Write a DATA frame of mode 0 with a payload of 2^lll bytes. Returns its length
+**/
+static uint8_t bench_frame(uint8_t* bb, uint8_t lll, uint8_t seed) {
+  uint8_t len = 1 << lll;
+  bb[0] = CMD_DATA | (lll << CMD_LLL_SHIFT);
+  for(uint8_t i=0;i<len;i++) bb[1+i] = (uint8_t) (seed + i * 13);
+  uint8_t sum = 0xFF;
+  for(uint8_t i=0;i<=len;i++) sum ^= bb[i];
+  bb[len+1] = sum;
+  return len + 2;
+}
+
+
+/**
+ * Read a free running cycle counter. On cores without one (Cortex-M0/M0+)
+ * and non-x86 hosts it counts microseconds or nanoseconds instead
+**/
+uint32_t EV3UARTBench::cycles() {
+#if defined(EV3UART_HOST) && (defined(__x86_64__) || defined(__i386__))
+  return (uint32_t) __rdtsc();
+#elif defined(EV3UART_HOST)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec);
+#elif defined(DWT_CTRL_CYCCNTENA_Msk)
+  if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  }
+  return DWT->CYCCNT;
+#else
+  return us_ticker_read();
+#endif
+}
+
+uint32_t EV3UARTBench::micros() {
+#ifdef EV3UART_HOST
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000);
+#else
+  return us_ticker_read();
+#endif
+}
+
+uint32_t EV3UARTBench::cycles_per_us() {
+  uint32_t us = micros(), start = cycles(), elapsed;
+  while((elapsed = micros() - us) < 10000) {}
+  uint32_t rate = (cycles() - start) / elapsed;
+  return rate ? rate : 1;
+}
+
+/**
+ * Nearest of the default colours to a reading, the way it is done without
+ * a table: chromaticity and brightness in float, then a search
+**/
+static uint8_t bench_color_float(int32_t red, int32_t green, int32_t blue) {
+  float p[3], sum = (float) (red + green + blue);
+  if (sum < 1) sum = 1;
+  p[0] = red / sum;
+  p[1] = green / sum;
+  p[2] = COLOR_BRIGHTNESS_WEIGHT * log2f(sum);
+  float best = -1;
+  uint8_t id = COLOR_NONE;
+  for(int k=0;k<DEFAULT_COLORS;k++) {
+    const EV3UARTColorCentroid &c = ev3uart_default_colors[k];
+    float csum = (float) (c.red + c.green + c.blue);
+    float q[3] = {c.red / csum, c.green / csum, COLOR_BRIGHTNESS_WEIGHT * log2f(csum)};
+    float d = 0;
+    for(int i=0;i<3;i++) d += (p[i] - q[i]) * (p[i] - q[i]);
+    if (best < 0 || d < best) {
+      best = d;
+      id = c.id;
+    }
+  }
+  return id;
+}
+
+/**
+ * Next pseudo random reading, each channel from 0 to 399
+**/
+static void bench_color_reading(uint32_t &seed, int32_t* rgb) {
+  for(int j=0;j<3;j++) {
+    seed = seed * 1103515245u + 12345u;
+    rgb[j] = (seed >> 16) % 400;
+  }
+}
+
+/**
+ * Compare the default table with bench_color_float() on
+ * COLOR_BENCH_READINGS readings, then classify r.iterations readings with
+ * each
+**/
+void EV3UARTBench::classify(EV3UARTColorBench &r) {
+  static int32_t rgb[64][3];
+  EV3UARTColorClassifier classifier;
+  uint32_t seed = 12345;
+  uint8_t confidence;
+  uint32_t same = 0;
+  for(uint32_t i=0;i<COLOR_BENCH_READINGS;i++) {
+    int32_t c[3];
+    bench_color_reading(seed, c);
+    if (classifier.classify(c[0], c[1], c[2], confidence) == bench_color_float(c[0], c[1], c[2])) same++;
+  }
+  r.agreement = (uint16_t) (same * 10000 / COLOR_BENCH_READINGS);
+  for(int i=0;i<64;i++) bench_color_reading(seed, rgb[i]);
+
+  uint32_t start = cycles(), us = micros();
+  for(uint32_t i=0;i<r.iterations;i++) {
+    const int32_t* c = rgb[i & 63];
+    bench_color_sink = classifier.classify(c[0], c[1], c[2], confidence);
+  }
+  r.table_cycles = cycles() - start;
+  us = micros() - us;
+  r.table_per_second = us ? (uint32_t) ((uint64_t) r.iterations * 1000000u / us) : 0;
+
+  start = cycles();
+  us = micros();
+  for(uint32_t i=0;i<r.iterations;i++) {
+    const int32_t* c = rgb[i & 63];
+    bench_color_sink = bench_color_float(c[0], c[1], c[2]);
+  }
+  r.float_cycles = cycles() - start;
+  us = micros() - us;
+  r.float_per_second = us ? (uint32_t) ((uint64_t) r.iterations * 1000000u / us) : 0;
+}
+
+/**
+ * Decode one payload r.iterations times with each decoder
+**/
+void EV3UARTBench::decode(EV3UARTDecodeBench &r) {
+  // A few different payloads, so the loop does not store into the one being decoded
+  uint8_t bb[8][MAX_PAYLOAD];
+  float value[MAX_PAYLOAD];
+  int32_t integer[MAX_PAYLOAD];
+  for(int i=0;i<8*MAX_PAYLOAD;i++) bb[i/MAX_PAYLOAD][i%MAX_PAYLOAD] = (uint8_t) (i * 37 + 11);
+  uint8_t sets = r.sets < MAX_DATA_ITEMS ? r.sets : MAX_DATA_ITEMS;
+  EV3UARTDecoder decoder = ev3uart_select_decoder(r.data_type, sets);
+  EV3UARTIntDecoder int_decoder = ev3uart_select_int_decoder(r.data_type);
+  r.generic_cycles = 0;
+  r.specialised_cycles = 0;
+  r.int_cycles = 0;
+  if (decoder == NULL) return;
+
+  uint32_t start = cycles();
+  for(uint32_t i=0;i<r.iterations;i++) {
+    ev3uart_decode_generic(r.data_type, bb[i & 7], value, sets);
+    bench_sink = value[0];
+  }
+  r.generic_cycles = cycles() - start;
+
+  start = cycles();
+  for(uint32_t i=0;i<r.iterations;i++) {
+    decoder(bb[i & 7], value, sets);
+    bench_sink = value[0];
+  }
+  r.specialised_cycles = cycles() - start;
+
+  start = cycles();
+  for(uint32_t i=0;i<r.iterations;i++) {
+    int_decoder(bb[i & 7], integer, sets);
+    bench_int_sink = integer[0];
+  }
+  r.int_cycles = cycles() - start;
+}
+
+/**
+ * Parse a capture twice. First as fast as possible, for the frames per
+ * cycle. Then at its original pace, polling every r.poll_us, next to a
+ * copy fed one byte at a time that gives the time each frame ended on the
+ * line. Needs stack for two sensors
+**/
+void EV3UARTBench::replay(EV3UARTReplayBench &r) {
+  EV3UARTSample sample;
+  r.bytes = 0;
+  r.frames = 0;
+  r.cycles = 0;
+  r.latency_mean_us = 0;
+  r.latency_max_us = 0;
+  {
+    EV3UARTReplay replay(r.data, r.size);
+    EV3UARTSensor sensor;
+    if (!replay.valid()) return;
+    replay.set_max_speed(true);
+    sensor.begin(replay, replay);
+    uint8_t stalled = 0;
+    uint32_t start = cycles();
+    while(!replay.done() && stalled < 3) {
+      uint32_t taken = replay.get_rx_bytes();
+      sensor.check_for_data();
+      // Only waiting for a change of speed that never comes stops progress
+      stalled = (replay.get_rx_bytes() == taken) ? stalled + 1 : 0;
+    }
+    r.cycles = cycles() - start;
+    r.bytes = replay.get_rx_bytes();
+    sensor.fetch_latest(sample);
+    if (sample.timestamp_us) r.frames = sample.seq + 1;
+  }
+  if (r.poll_us == 0) return;
+
+  EV3UARTReplay line(r.data, r.size), paced(r.data, r.size);
+  EV3UARTSensor reference, polled;
+  line.set_max_speed(true);
+  reference.begin(line, line);
+  polled.begin(paced, paced);
+  uint32_t samples = 0;
+  uint64_t total = 0;
+  // Stop if the paced copy waits for a change of speed for a second
+  while(!paced.done() && (int32_t) (paced.read_us() - paced.get_next_time()) < 1000000) {
+    paced.advance_us(r.poll_us);
+    polled.check_for_data();
+    while(polled.fetch_samples(&sample, 1)) {
+      // Feed the reference until it decodes the same frame
+      EV3UARTSample ended;
+      bool found = false;
+      uint8_t stalled = 0;
+      while(!found && !line.done() && stalled < 3) {
+        if (line.readable()) {
+          uint8_t b = line.getc();
+          reference.feed(&b, 1);
+          stalled = 0;
+        } else {
+          reference.check_for_data();
+          stalled++;
+        }
+        while(reference.fetch_samples(&ended, 1))
+          if (ended.seq == sample.seq) found = true;
+      }
+      if (!found) return;
+      uint32_t latency = sample.timestamp_us - ended.timestamp_us;
+      total += latency;
+      samples++;
+      if (latency > r.latency_max_us) r.latency_max_us = latency;
+      r.latency_mean_us = (uint32_t) (total / samples);
+    }
+  }
+}
+
+/**
+ * Parse r.bytes of DATA frames of the format r.data_type with r.payload
+ * bytes of payload, as fast as they can be fed. Mode 0 of a connected
+ * colour sensor is given the format. False for a format that does not fit
+ * the payload or a parser that decodes nothing
+**/
+bool EV3UARTBench::parse(EV3UARTParseBench &r) {
+  static uint8_t stream[16 * MAX_MESSAGE_SIZE];
+  EV3UARTBenchLine line;
+  EV3UARTSensor sensor;
+  uint8_t size = ev3uart_type_size(r.data_type);
+  uint8_t lll = 0;
+  r.frames = 0;
+  r.cycles = 0;
+  r.us = 0;
+  r.bytes_per_second = 0;
+  r.frames_per_second = 0;
+  while((1 << lll) < r.payload) lll++;
+  if (r.data_type > DATA_F || r.payload < size || (1 << lll) != r.payload || lll > 5) return false;
+  if (!bench_connect(sensor, line)) return false;
+  sensor.get_mode(0)->set_format(r.payload / size, r.data_type, 4, 0);
+
+  size_t len = 0;
+  for(int i=0;i<16;i++) len += bench_frame(stream + len, lll, (uint8_t) (i * 29));
+  uint32_t rounds = (r.bytes + len - 1) / len;
+  EV3UARTStats before, after;
+  sensor.get_stats(before);
+  uint32_t start = cycles();
+  for(uint32_t i=0;i<rounds;i++) sensor.feed(stream, len);
+  r.cycles = cycles() - start;
+  sensor.get_stats(after);
+  r.bytes = rounds * len;
+  r.frames = after.frames - before.frames;
+  // From the cycles, the microsecond counter is too coarse for short runs
+  uint64_t rate = cycles_per_us();
+  r.us = (uint32_t) (r.cycles / rate);
+  if (r.cycles) {
+    r.bytes_per_second = (uint32_t) ((uint64_t) r.bytes * rate * 1000000u / r.cycles);
+    r.frames_per_second = (uint32_t) ((uint64_t) r.frames * rate * 1000000u / r.cycles);
+  }
+  return r.frames == rounds * 16;
+}
+
+/**
+ * Process the colour sensor handshake r.iterations times, resetting the
+ * sensor before each. False if a handshake does not reach its ACK
+**/
+bool EV3UARTBench::handshake(EV3UARTHandshakeBench &r) {
+  static uint8_t bb[SIM_BUFFER_SIZE];
+  EV3UARTBenchLine line;
+  EV3UARTSensor sensor;
+  EV3UARTProgress progress;
+  uint64_t total = 0;
+  r.bytes = bench_handshake(bb, sizeof(bb));
+  r.cycles = 0;
+  r.ns = 0;
+  if (r.bytes == 0 || r.iterations == 0) return false;
+  sensor.begin(line, line);
+  for(uint32_t i=0;i<r.iterations;i++) {
+    sensor.reset();
+    uint32_t start = cycles();
+    sensor.feed(bb, r.bytes);
+    total += cycles() - start;
+    sensor.get_progress(progress);
+    if (progress.step != HANDSHAKE_ACK) return false;
+  }
+  r.cycles = (uint32_t) (total / r.iterations);
+  r.ns = (uint32_t) ((uint64_t) r.cycles * 1000 / cycles_per_us());
+  return true;
+}
+
+/**
+ * Make one COL-REFLECT frame readable at a time and time check_for_data()
+ * and fetch_sample() until the frame's value is returned
+**/
+bool EV3UARTBench::latency(EV3UARTLatencyBench &r) {
+  EV3UARTBenchLine line;
+  EV3UARTSensor sensor;
+  uint8_t frame[MAX_MESSAGE_SIZE];
+  float value[MAX_DATA_ITEMS];
+  uint8_t mode;
+  uint32_t min = 0xFFFFFFFF, max = 0;
+  uint64_t total = 0;
+  r.min_ns = 0;
+  r.mean_ns = 0;
+  r.max_ns = 0;
+  r.mean_cycles = 0;
+  if (r.iterations == 0 || !bench_connect(sensor, line)) return false;
+  for(uint32_t i=0;i<r.iterations;i++) {
+    uint8_t seed = (uint8_t) (i % 100);
+    line.load(frame, bench_frame(frame, 0, seed));
+    line.now += 1000;
+    uint32_t start = cycles();
+    do {
+      sensor.check_for_data();
+      sensor.fetch_sample(value, 0, mode);
+    } while(value[0] != seed && line.readable());
+    uint32_t c = cycles() - start;
+    if (value[0] != seed) return false;
+    total += c;
+    if (c < min) min = c;
+    if (c > max) max = c;
+  }
+  uint32_t rate = cycles_per_us();
+  r.mean_cycles = (uint32_t) (total / r.iterations);
+  r.min_ns = (uint32_t) ((uint64_t) min * 1000 / rate);
+  r.mean_ns = (uint32_t) ((uint64_t) r.mean_cycles * 1000 / rate);
+  r.max_ns = (uint32_t) ((uint64_t) max * 1000 / rate);
+  return true;
+}
+
+/**
+ * Stream REF-RAW frames back to back from the simulator for r.duration_us,
+ * flipping bits in r.errors_per_million bytes, and count the frames that do
+ * not arrive. False if the sensor does not connect
+**/
+bool EV3UARTBench::noise(EV3UARTNoiseBench &r) {
+  EV3UARTSimulator sim;
+  EV3UARTSensor sensor;
+  EV3UARTStats before, after;
+  r.bit_errors = 0;
+  r.frames_sent = 0;
+  r.frames = 0;
+  r.frames_lost = 0;
+  r.checksum_errors = 0;
+  r.resets = 0;
+  sim.set_frame_period_us(0);
+  sensor.begin(sim, sim);
+  for(int i=0;i<5000 && sensor.get_status() != DATA_MODE;i++) {
+    sim.advance_us(1000);
+    sensor.check_for_data();
+  }
+  if (sensor.get_status() != DATA_MODE) return false;
+  sensor.set_mode(RefRaw);
+  sim.set_bit_errors(r.errors_per_million);
+  sensor.get_stats(before);
+  uint32_t sent = sim.get_frames_sent();
+  for(uint32_t t=0;t<r.duration_us;t+=1000) {
+    sim.advance_us(1000);
+    sensor.check_for_data();
+  }
+  // Stop queueing frames and let the ones on the line arrive. The watchdog
+  // would take the silence for an unplug and reset the sensor
+  sensor.set_watchdog(0);
+  sim.set_frame_period_us(0x7FFFFFFF);
+  for(int i=0;i<100;i++) {
+    sim.advance_us(1000);
+    sensor.check_for_data();
+  }
+  sensor.get_stats(after);
+  r.bit_errors = sim.get_bit_errors();
+  r.frames_sent = sim.get_frames_sent() - sent;
+  r.frames = after.frames - before.frames;
+  r.frames_lost = r.frames_sent > r.frames ? r.frames_sent - r.frames : 0;
+  r.checksum_errors = after.checksum_errors - before.checksum_errors;
+  r.resets = after.resets - before.resets;
+  return true;
+}
+
+/**
+ * Record a session with the simulator into bb: the handshake, then
+ * COL-REFLECT frames about every 10 ms with a changing value, until bb is nearly
+ * full. Polled every 100 us, so the bytes are recorded close to the time
+ * they arrive. Size of the capture
+**/
+static size_t bench_record(uint8_t* bb, size_t size) {
+  EV3UARTSimulator sim;
+  EV3UARTCapture capture(sim, sim);
+  EV3UARTSensor sensor;
+  // Not a multiple of the polling period, so frames end at every phase of it
+  sim.set_frame_period_us(9900);
+  capture.set_buffer(bb, size);
+  sensor.begin(capture, sim);
+  for(uint32_t t=0;t<100000 && capture.get_size() + 64 < size;t++) {
+    sim.set_value(0, (int32_t) (t / 100 % 100));
+    sim.advance_us(100);
+    sensor.check_for_data();
+  }
+  capture.stop();
+  return capture.get_size();
+}
+
+/**
+ * Run the parse benchmark for every format and payload length, the decode
+ * one for every format, then the classify, handshake, latency, replay and
+ * noise ones, and write one JSON object to out
+**/
+void EV3UARTBench::report(FILE* out) {
+  static const char* type_name[] = {"Data8", "Data16", "Data32", "DataF"};
+  fprintf(out, "{\n  \"format\": 1,\n  \"cycles_per_us\": %lu,\n  \"parse\": [",
+          (unsigned long) cycles_per_us());
+  bool first = true;
+  for(uint8_t type=DATA_8;type<=DATA_F;type++) {
+    for(uint8_t payload=1;payload<=32;payload*=2) {
+      EV3UARTParseBench p;
+      p.data_type = type;
+      p.payload = payload;
+      p.bytes = BENCH_PARSE_BYTES;
+      if (payload < ev3uart_type_size(type)) continue;
+      bool ok = parse(p);
+      fprintf(out, "%s\n    {\"data_type\": \"%s\", \"payload\": %u, \"ok\": %s, \"bytes\": %lu, "
+              "\"frames\": %lu, \"cycles\": %lu, \"bytes_per_second\": %lu, \"frames_per_second\": %lu}",
+              first ? "" : ",", type_name[type], payload, ok ? "true" : "false", (unsigned long) p.bytes,
+              (unsigned long) p.frames, (unsigned long) p.cycles, (unsigned long) p.bytes_per_second,
+              (unsigned long) p.frames_per_second);
+      first = false;
+    }
+  }
+  fprintf(out, "\n  ],\n  \"decode\": [");
+  first = true;
+  for(uint8_t type=DATA_8;type<=DATA_F;type++) {
+    for(uint8_t sets=1;sets<=3;sets+=2) {
+      EV3UARTDecodeBench d;
+      d.data_type = type;
+      d.sets = sets;
+      d.iterations = 100000;
+      decode(d);
+      fprintf(out, "%s\n    {\"data_type\": \"%s\", \"sets\": %u, \"iterations\": %lu, \"generic_cycles\": %lu, "
+              "\"specialised_cycles\": %lu, \"int_cycles\": %lu}", first ? "" : ",", type_name[type], sets,
+              (unsigned long) d.iterations, (unsigned long) d.generic_cycles,
+              (unsigned long) d.specialised_cycles, (unsigned long) d.int_cycles);
+      first = false;
+    }
+  }
+  EV3UARTColorBench c;
+  c.iterations = 1000000;
+  classify(c);
+  fprintf(out, "\n  ],\n  \"classify\": {\"iterations\": %lu, \"table_cycles\": %lu, \"float_cycles\": %lu, "
+          "\"table_per_second\": %lu, \"float_per_second\": %lu, \"agreement\": %u},\n",
+          (unsigned long) c.iterations, (unsigned long) c.table_cycles, (unsigned long) c.float_cycles,
+          (unsigned long) c.table_per_second, (unsigned long) c.float_per_second, c.agreement);
+  EV3UARTHandshakeBench h;
+  h.iterations = 1000;
+  bool ok = handshake(h);
+  fprintf(out, "  \"handshake\": {\"ok\": %s, \"iterations\": %lu, \"bytes\": %lu, "
+          "\"cycles\": %lu, \"ns\": %lu},\n", ok ? "true" : "false", (unsigned long) h.iterations,
+          (unsigned long) h.bytes, (unsigned long) h.cycles, (unsigned long) h.ns);
+  EV3UARTLatencyBench l;
+  l.iterations = 10000;
+  ok = latency(l);
+  fprintf(out, "  \"latency\": {\"ok\": %s, \"iterations\": %lu, \"min_ns\": %lu, \"mean_ns\": %lu, "
+          "\"max_ns\": %lu, \"mean_cycles\": %lu},\n", ok ? "true" : "false",
+          (unsigned long) l.iterations, (unsigned long) l.min_ns, (unsigned long) l.mean_ns,
+          (unsigned long) l.max_ns, (unsigned long) l.mean_cycles);
+  static uint8_t capture[BENCH_CAPTURE_SIZE];
+  EV3UARTReplayBench p;
+  p.data = capture;
+  p.size = bench_record(capture, sizeof(capture));
+  p.poll_us = 1000;
+  replay(p);
+  fprintf(out, "  \"replay\": {\"size\": %lu, \"poll_us\": %lu, \"bytes\": %lu, \"frames\": %lu, \"cycles\": %lu, "
+          "\"latency_mean_us\": %lu, \"latency_max_us\": %lu},\n", (unsigned long) p.size,
+          (unsigned long) p.poll_us, (unsigned long) p.bytes, (unsigned long) p.frames,
+          (unsigned long) p.cycles, (unsigned long) p.latency_mean_us, (unsigned long) p.latency_max_us);
+  static const uint32_t error_rates[] = {0, 100, 1000, 10000};
+  fprintf(out, "  \"noise\": [");
+  for(int i=0;i<4;i++) {
+    EV3UARTNoiseBench n;
+    n.errors_per_million = error_rates[i];
+    n.duration_us = 20000000;
+    ok = noise(n);
+    fprintf(out, "%s\n    {\"ok\": %s, \"errors_per_million\": %lu, \"duration_us\": %lu, \"bit_errors\": %lu, "
+            "\"frames_sent\": %lu, \"frames\": %lu, \"frames_lost\": %lu, \"checksum_errors\": %lu, "
+            "\"resets\": %lu}", i ? "," : "", ok ? "true" : "false", (unsigned long) n.errors_per_million,
+            (unsigned long) n.duration_us, (unsigned long) n.bit_errors, (unsigned long) n.frames_sent,
+            (unsigned long) n.frames, (unsigned long) n.frames_lost, (unsigned long) n.checksum_errors,
+            (unsigned long) n.resets);
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,137 @@
+// EV3UARTBench.h
+//
+// Micro benchmarks of the library hot paths. They run on the target (cycle
+// counter of Cortex-M3 and above, microsecond ticker otherwise) and on hosts
+// built with EV3UART_HOST.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTBENCH_H
+#define EV3UARTBENCH_H
+
+#include "EV3UARTSensor.h"
+#include "EV3UARTCapture.h"
+#include "EV3UARTColor.h"
+
+/**
+* Result of decoding the same DATA payload many times
+**/
+struct EV3UARTDecodeBench {
+	uint8_t data_type;                    // The format measured
+	uint8_t sets;
+	uint32_t iterations;                  // Number of payloads decoded by each decoder
+	uint32_t generic_cycles;              // Total for the switch on the data type of every item
+	uint32_t specialised_cycles;          // Total for the decoder selected for the format
+	uint32_t int_cycles;                  // Total for the integer decoder, see EV3UARTFrame::to_int()
+};
+
+/**
+* Result of parsing a capture of a real session, see EV3UARTCapture
+**/
+struct EV3UARTReplayBench {
+	const uint8_t* data;                  // The capture
+	size_t size;
+	uint32_t poll_us;                     // Period of check_for_data() for the latency
+	uint32_t bytes;                       // Bytes received in the capture
+	uint32_t frames;                      // Valid DATA frames decoded
+	uint32_t cycles;                      // Time to parse the whole capture as fast as possible
+	uint32_t latency_mean_us;             // From the capture time of the last byte of a frame to its
+	uint32_t latency_max_us;              // sample, calling check_for_data() every poll_us
+};
+
+/**
+* Result of classifying RGB raw readings, with the table of
+* EV3UARTColorClassifier and with a nearest centroid search in float
+**/
+struct EV3UARTColorBench {
+	uint32_t iterations;                  // Number of readings classified by each
+	uint32_t table_cycles;                // Totals
+	uint32_t float_cycles;
+	uint32_t table_per_second;            // Classifications per second
+	uint32_t float_per_second;
+	uint16_t agreement;                   // Readings in 10000 both give the same colour
+};
+
+/**
+* Result of parsing DATA frames of one format, see EV3UARTBench::parse()
+**/
+struct EV3UARTParseBench {
+	uint8_t data_type;                    // Format of the frames
+	uint8_t payload;                      // Payload length in bytes: 1, 2, 4, 8, 16 or 32
+	uint32_t bytes;                       // Bytes to parse, rounded up to whole frames
+	uint32_t frames;                      // Valid frames decoded
+	uint32_t cycles;                      // Time taken
+	uint32_t us;
+	uint32_t bytes_per_second;
+	uint32_t frames_per_second;
+};
+
+/**
+* Result of processing the handshake of a colour sensor, from CMD_TYPE to
+* the ACK, with all its INFO messages
+**/
+struct EV3UARTHandshakeBench {
+	uint32_t iterations;                  // Handshakes processed
+	uint32_t bytes;                       // Length of the handshake
+	uint32_t cycles;                      // Mean per handshake
+	uint32_t ns;
+};
+
+/**
+* Time from the last byte of a DATA frame being readable to its value
+* being returned by fetch_sample(), through check_for_data()
+**/
+struct EV3UARTLatencyBench {
+	uint32_t iterations;                  // Frames measured
+	uint32_t min_ns;
+	uint32_t mean_ns;
+	uint32_t max_ns;
+	uint32_t mean_cycles;
+};
+
+/**
+* Frames lost to bit errors on a simulated line, see
+* EV3UARTSimulator::set_bit_errors()
+**/
+struct EV3UARTNoiseBench {
+	uint32_t errors_per_million;          // Bytes with a flipped bit per million
+	uint32_t duration_us;                 // Time streamed, on the simulator's clock
+	uint32_t bit_errors;                  // Bits flipped
+	uint32_t frames_sent;                 // REF-RAW frames sent back to back at 57600 baud
+	uint32_t frames;                      // Valid frames decoded
+	uint32_t frames_lost;
+	uint32_t checksum_errors;
+	uint32_t resets;                      // Connections lost
+};
+
+/**
+* Library benchmarks
+*
+* @code
+* EV3UARTDecodeBench r;
+* r.data_type = DATA_16;
+* r.sets = 3;
+* r.iterations = 10000;
+* EV3UARTBench::decode(r);
+* printf("%lu -> %lu cycles per frame, %lu as integers\n", r.generic_cycles / r.iterations,
+*        r.specialised_cycles / r.iterations, r.int_cycles / r.iterations);
+*
+* EV3UARTBench::report(stdout);                // Everything, for tracking between releases
+* @endcode
+**/
+class EV3UARTBench {
+	public:
+		static uint32_t cycles();                      // Free running cycle counter
+		static uint32_t micros();                      // Free running microsecond counter
+		static uint32_t cycles_per_us();               // Rate of cycles(), measured over 10 ms
+		static void decode(EV3UARTDecodeBench &r);     // Compare the generic and selected decoders
+		static void replay(EV3UARTReplayBench &r);     // Parse a capture for throughput and latency
+		static void classify(EV3UARTColorBench &r);    // Compare the colour table and a float search
+		static bool parse(EV3UARTParseBench &r);       // Parser throughput for one format
+		static bool handshake(EV3UARTHandshakeBench &r); // Handshake processing time
+		static bool latency(EV3UARTLatencyBench &r);   // Frame to fetch_sample() latency
+		static bool noise(EV3UARTNoiseBench &r);       // Frames lost to bit errors
+		static void report(FILE* out);                 // Run the suite and write the results as JSON
+};
+
+#endif
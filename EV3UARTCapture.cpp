@@ -0,0 +1,301 @@
+// EV3UARTCapture.cpp
+//
+// Recording of the traffic with a sensor and playing it back.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTCapture.h"
+
+static const uint8_t capture_magic[4] = {'E', 'V', '3', 'R'};
+
+EV3UARTCapture::EV3UARTCapture(EV3UARTTransport &transport, EV3UARTTimer &timer) {
+  this->transport = &transport;
+  this->timer = &timer;
+  buffer = NULL;
+  buffer_size = 0;
+  file = NULL;
+  size = 0;
+  dropped = 0;
+  last = 0;
+  active = false;
+}
+
+/**
+ * Record into bb, replacing anything recorded before. When it is full,
+ * further records are dropped and counted
+**/
+void EV3UARTCapture::set_buffer(uint8_t* bb, size_t size) {
+  active = false;
+  buffer = bb;
+  buffer_size = size;
+  file = NULL;
+  start();
+}
+
+/**
+ * Record into an open file. Records are then written with no locking, so
+ * the transport must be polled, with no RX or TX interrupt nor heartbeat
+ * Ticker, and used from one thread only
+**/
+void EV3UARTCapture::set_file(FILE* file) {
+  active = false;
+  buffer = NULL;
+  this->file = file;
+  start();
+}
+
+void EV3UARTCapture::stop() {
+  active = false;
+  if (file) fflush(file);
+}
+
+size_t EV3UARTCapture::get_size() {
+  return size;
+}
+
+uint32_t EV3UARTCapture::get_dropped() {
+  return dropped;
+}
+
+void EV3UARTCapture::start() {
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  memcpy(header, capture_magic, 4);
+  header[4] = CAPTURE_VERSION;
+  size = 0;
+  dropped = 0;
+  last = timer->read_us();
+  if (buffer && buffer_size < CAPTURE_HEADER_SIZE) return;
+  write(header, CAPTURE_HEADER_SIZE);
+  active = true;
+}
+
+/**
+ * Add a record, whole or not at all. The time of a dropped record is
+ * counted in the next one. Records come from the RX and TX interrupts, the
+ * heartbeat Ticker and the application, so recording into the buffer is
+ * done with interrupts masked, a few microseconds
+**/
+void EV3UARTCapture::record(uint8_t kind, uint32_t value) {
+  if (!active) return;
+  if (buffer == NULL) {
+    encode(kind, value);
+    return;
+  }
+  EV3UART_CRITICAL_ENTER();
+  encode(kind, value);
+  EV3UART_CRITICAL_EXIT();
+}
+
+void EV3UARTCapture::encode(uint8_t kind, uint32_t value) {
+  uint8_t bb[CAPTURE_RECORD_MAX];
+  uint8_t len = 0;
+  uint32_t now = timer->read_us();
+  // Deltas too long for 30 bits are cut; captures do not pause for 17 minutes
+  uint32_t delta = now - last;
+  if (delta > 0x3FFFFFFF) delta = 0x3FFFFFFF;
+  uint32_t n = (delta << 2) | kind;
+  while (n >= 0x80) {
+    bb[len++] = (uint8_t) (n | 0x80);
+    n >>= 7;
+  }
+  bb[len++] = (uint8_t) n;
+  if (kind == CAPTURE_BAUD) {
+    for(int i=0;i<4;i++) bb[len++] = (uint8_t) (value >> (8*i));
+  } else {
+    bb[len++] = (uint8_t) value;
+  }
+  if (buffer && size + len > buffer_size) {
+    dropped++;
+    return;
+  }
+  write(bb, len);
+  last = now;
+}
+
+void EV3UARTCapture::write(const uint8_t* bb, uint8_t len) {
+  if (buffer) memcpy(buffer + size, bb, len);
+  else if (file) fwrite(bb, 1, len, file);
+  size += len;
+}
+
+void EV3UARTCapture::baud(uint32_t rate) {
+  record(CAPTURE_BAUD, rate);
+  transport->baud(rate);
+}
+
+bool EV3UARTCapture::readable() {
+  return transport->readable();
+}
+
+uint8_t EV3UARTCapture::getc() {
+  uint8_t b = transport->getc();
+  record(CAPTURE_RX, b);
+  return b;
+}
+
+bool EV3UARTCapture::writeable() {
+  return transport->writeable();
+}
+
+void EV3UARTCapture::putc(uint8_t b) {
+  record(CAPTURE_TX, b);
+  transport->putc(b);
+}
+
+/**
+ * The interrupts are those of the wrapped transport. The sensor reads and
+ * writes through this one from its handlers, so nothing is missed
+**/
+bool EV3UARTCapture::attach_rx(EV3UARTHandler handler, void* context) {
+  return transport->attach_rx(handler, context);
+}
+
+bool EV3UARTCapture::attach_tx(EV3UARTHandler handler, void* context) {
+  return transport->attach_tx(handler, context);
+}
+
+void EV3UARTCapture::enable_tx(bool enable) {
+  transport->enable_tx(enable);
+}
+
+bool EV3UARTCapture::wait_readable(uint32_t timeout_us) {
+  return transport->wait_readable(timeout_us);
+}
+
+EV3UARTReplay::EV3UARTReplay(const uint8_t* data, size_t size) {
+  this->data = data;
+  this->size = size;
+  max_speed = false;
+  rewind();
+}
+
+bool EV3UARTReplay::valid() {
+  return size >= CAPTURE_HEADER_SIZE && memcmp(data, capture_magic, 4) == 0 &&
+         data[4] == CAPTURE_VERSION;
+}
+
+/**
+ * Start again from the first record, with the clock at zero
+**/
+void EV3UARTReplay::rewind() {
+  pos = CAPTURE_HEADER_SIZE;
+  pending = false;
+  at = 0;
+  now = 0;
+  host_baud = 0;
+  last_rx = 0;
+  rx_bytes = 0;
+  tx_bytes = 0;
+  if (valid()) next();
+}
+
+void EV3UARTReplay::set_max_speed(bool max) {
+  max_speed = max;
+}
+
+void EV3UARTReplay::advance_us(uint32_t us) {
+  now += us;
+}
+
+/**
+ * True when nothing is left to receive. Bytes the sensor sent in the
+ * capture are not needed
+**/
+bool EV3UARTReplay::done() {
+  while (pending && kind == CAPTURE_TX) next();
+  return !pending;
+}
+
+uint32_t EV3UARTReplay::get_last_rx_time() {
+  return last_rx;
+}
+
+uint32_t EV3UARTReplay::get_next_time() {
+  return at;
+}
+
+uint32_t EV3UARTReplay::get_rx_bytes() {
+  return rx_bytes;
+}
+
+uint32_t EV3UARTReplay::get_tx_bytes() {
+  return tx_bytes;
+}
+
+/**
+ * Decode the record at pos. A record cut short at the end of the data
+ * ends the replay
+**/
+bool EV3UARTReplay::next() {
+  pending = false;
+  uint32_t n = 0;
+  uint8_t shift = 0;
+  while (pos < size) {
+    uint8_t b = data[pos++];
+    if (shift < 32) n |= (uint32_t) (b & 0x7F) << shift;
+    shift += 7;
+    if (!(b & 0x80)) {
+      kind = n & 3;
+      at += n >> 2;
+      uint8_t len = (kind == CAPTURE_BAUD) ? 4 : 1;
+      if (pos + len > size) return false;
+      value = 0;
+      for(int i=0;i<len;i++) value |= (uint32_t) data[pos++] << (8*i);
+      pending = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Remember the rate the sensor set, which releases the bytes recorded after
+ * the same change
+**/
+void EV3UARTReplay::baud(uint32_t rate) {
+  host_baud = rate;
+}
+
+bool EV3UARTReplay::readable() {
+  while (pending) {
+    if (kind == CAPTURE_TX) {
+      next();
+    } else if (kind == CAPTURE_BAUD) {
+      // Wait for the sensor to change speed as it did in the capture
+      if (max_speed && (int32_t) (at - now) > 0) now = at;
+      if (host_baud != value) return false;
+      next();
+    } else {
+      return max_speed || (int32_t) (now - at) >= 0;
+    }
+  }
+  return false;
+}
+
+/**
+ * Take the next received byte. Only after readable()
+**/
+uint8_t EV3UARTReplay::getc() {
+  uint8_t b = (uint8_t) value;
+  if (max_speed && (int32_t) (at - now) > 0) now = at;
+  last_rx = at;
+  rx_bytes++;
+  next();
+  return b;
+}
+
+bool EV3UARTReplay::writeable() {
+  return true;
+}
+
+void EV3UARTReplay::putc(uint8_t b) {
+  tx_bytes++;
+}
+
+uint32_t EV3UARTReplay::read_us() {
+  return now;
+}
+
+void EV3UARTReplay::delay_ms(uint32_t ms) {
+  now += ms * 1000;
+}
@@ -0,0 +1,139 @@
+// EV3UARTCapture.h
+//
+// Recording of the traffic with a sensor and playing it back. A capture is
+// a compact binary log of the bytes received and sent and of the changes of
+// bit rate, each with its time, so a session with a real sensor can be
+// parsed again offline, as fast as possible or at its original pace.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTCAPTURE_H
+#define EV3UARTCAPTURE_H
+
+#include "EV3UARTTransport.h"
+
+// Kinds of capture records
+#define CAPTURE_RX 0                      // A byte received from the sensor
+#define CAPTURE_TX 1                      // A byte sent to the sensor
+#define CAPTURE_BAUD 2                    // A change of bit rate
+
+// Capture format: the magic "EV3R" and a version byte, then the records.
+// Each record starts with a number stored 7 bits per byte, least significant
+// first, with the top bit set on all bytes but the last. It holds
+// (delta_us << 2) | kind, delta_us being the time since the previous record.
+// CAPTURE_RX and CAPTURE_TX records are followed by the byte, CAPTURE_BAUD by
+// the bit rate in 4 bytes, little endian. A byte at 57600 baud takes 3 bytes
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 5
+#define CAPTURE_RECORD_MAX 9
+
+/**
+* Transport that records everything passing through another transport.
+* Give it to EV3UARTSensor::begin() in place of the transport it wraps.
+* A capture into a buffer can be taken with the sensor's interrupts in use;
+* a capture into a file only with a polled transport.
+*
+* @code
+* static uint8_t log[16384];
+* EV3UARTLinuxTransport serial;
+* EV3UARTLinuxTimer timer;
+* EV3UARTCapture capture(serial, timer);
+* capture.set_buffer(log, sizeof(log));
+* serial.open("/dev/ttyUSB0");
+* sensor.begin(capture, timer);
+* @endcode
+**/
+class EV3UARTCapture : public EV3UARTTransport {
+	public:
+		EV3UARTCapture(EV3UARTTransport &transport, EV3UARTTimer &timer);
+		void set_buffer(uint8_t* bb, size_t size);     // Start a capture into memory
+		void set_file(FILE* file);                     // Start a capture into a file. Polled transports only
+		void stop();                                   // Stop recording
+		size_t get_size();                             // Bytes of capture written, with the header
+		uint32_t get_dropped();                        // Records lost because the buffer was full
+
+		// EV3UARTTransport
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+		bool attach_rx(EV3UARTHandler handler, void* context);
+		bool attach_tx(EV3UARTHandler handler, void* context);
+		void enable_tx(bool enable);
+		bool wait_readable(uint32_t timeout_us);
+
+	private:
+		void start();                                  // Write the header
+		void record(uint8_t kind, uint32_t value);     // Add a record, from any context
+		void encode(uint8_t kind, uint32_t value);     // Add a record, with no locking
+		void write(const uint8_t* bb, uint8_t len);
+		EV3UARTTransport *transport;                   // The transport recorded
+		EV3UARTTimer *timer;
+		uint8_t *buffer;                               // Memory to record into, or NULL
+		size_t buffer_size;
+		FILE *file;                                    // File to record into, or NULL
+		size_t size;                                   // Bytes written
+		uint32_t dropped;
+		uint32_t last;                                 // Time of the last record
+		bool active;
+};
+
+/**
+* Transport and timer that play a capture back to a sensor. The clock is
+* virtual: at the original speed, received bytes become readable when
+* advance_us() or delay_ms() reaches their time; at the maximum speed they
+* are all readable at once and the clock jumps to the time of each byte
+* taken. Bytes recorded after a change of bit rate are held back until the
+* sensor changes to the same rate, so the handshake completes as it did.
+*
+* @code
+* EV3UARTReplay replay(log, size);
+* EV3UARTSensor sensor;
+* replay.set_max_speed(true);
+* sensor.begin(replay, replay);
+* while (!replay.done()) sensor.check_for_data();
+* @endcode
+**/
+class EV3UARTReplay : public EV3UARTTransport, public EV3UARTTimer {
+	public:
+		EV3UARTReplay(const uint8_t* data, size_t size);
+		bool valid();                                  // True if the data starts with a capture header
+		void rewind();                                 // Play from the start again
+		void set_max_speed(bool max);                  // Feed bytes as fast as they are taken
+		void advance_us(uint32_t us);                  // Move the virtual clock forward
+		bool done();                                   // True when every received byte has been taken
+		uint32_t get_last_rx_time();                   // Capture time of the last byte taken
+		uint32_t get_next_time();                      // Capture time of the next record
+		uint32_t get_rx_bytes();                       // Received bytes taken so far
+		uint32_t get_tx_bytes();                       // Bytes sent by the sensor being fed
+
+		// EV3UARTTransport
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+
+		// EV3UARTTimer
+		uint32_t read_us();
+		void delay_ms(uint32_t ms);
+
+	private:
+		bool next();                                   // Decode the next record, false at the end
+		const uint8_t *data;
+		size_t size;
+		size_t pos;                                    // Next record to decode
+		bool pending;                                  // A decoded record is waiting
+		uint8_t kind;                                  // Its kind, time and byte or bit rate
+		uint32_t at;
+		uint32_t value;
+		bool max_speed;
+		uint32_t now;                                  // The virtual clock
+		uint32_t host_baud;                            // Bit rate set by the sensor being fed
+		uint32_t last_rx;
+		uint32_t rx_bytes;
+		uint32_t tx_bytes;
+};
+
+#endif
@@ -0,0 +1,200 @@
+// EV3UARTColor.cpp
+//
+// Colour classification of RGB raw readings with a lookup table.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTColor.h"
+#include <math.h>
+
+// Measured on LEGO bricks. Train with readings of the actual surfaces and
+// lighting for better results
+const EV3UARTColorCentroid ev3uart_default_colors[DEFAULT_COLORS] = {
+  {COLOR_NONE,     2,   2,   2},
+  {COLOR_BLACK,   30,  35,  25},
+  {COLOR_BLUE,    40,  80, 150},
+  {COLOR_GREEN,   50, 140,  60},
+  {COLOR_YELLOW, 300, 260,  70},
+  {COLOR_RED,    280,  50,  30},
+  {COLOR_WHITE,  330, 390, 280},
+  {COLOR_BROWN,   90,  60,  35},
+};
+
+EV3UARTColorClassifier::EV3UARTColorClassifier() {
+  train(ev3uart_default_colors, DEFAULT_COLORS);
+}
+
+/**
+ * Position of a reading in the space the distances are measured in:
+ * chromaticities, and brightness in octaves times COLOR_BRIGHTNESS_WEIGHT
+**/
+static void color_point(float red, float green, float blue, float* p) {
+  float sum = red + green + blue;
+  if (sum < 1) sum = 1;
+  p[0] = red / sum;
+  p[1] = green / sum;
+  p[2] = COLOR_BRIGHTNESS_WEIGHT * logf(sum) / logf(2);
+}
+
+/**
+ * Index of the nearest of n points to p, and the squared distances to the
+ * nearest and the second nearest
+**/
+static uint8_t color_nearest(const float* p, const float (*points)[3], uint8_t n, float &best, float &second) {
+  uint8_t nearest = 0;
+  best = -1;
+  second = -1;
+  for(uint8_t k=0;k<n;k++) {
+    float d = 0;
+    for(int i=0;i<3;i++) d += (p[i] - points[k][i]) * (p[i] - points[k][i]);
+    if (best < 0 || d < best) {
+      second = best;
+      best = d;
+      nearest = k;
+    } else if (second < 0 || d < second) {
+      second = d;
+    }
+  }
+  return nearest;
+}
+
+// Fraction bits of the points compared by search()
+#define COLOR_FRACTION 12
+
+// Cells are widened by this fraction of a bin when checked, to cover the
+// rounding down of the chromaticity when classifying
+#define COLOR_MARGIN (1.0f / 32)
+
+/**
+ * Fill the table with the nearest of n centroids to the centre of each
+ * cell, or mark the cell to search when a corner of it is nearer to
+ * another centroid. Up to COLOR_MAX_ID + 1 centroids are used
+**/
+void EV3UARTColorClassifier::train(const EV3UARTColorCentroid* centroids, uint8_t n) {
+  float points[COLOR_MAX_ID + 1][3];
+  if (n > COLOR_MAX_ID + 1) n = COLOR_MAX_ID + 1;
+  count = n;
+  for(uint8_t k=0;k<n;k++) {
+    color_point(centroids[k].red, centroids[k].green, centroids[k].blue, points[k]);
+    for(int i=0;i<3;i++) point[k][i] = (int16_t) floorf(points[k][i] * (1 << COLOR_FRACTION) + 0.5f);
+    id[k] = centroids[k].id & COLOR_MAX_ID;
+  }
+  for(uint8_t level=0;level<COLOR_LEVELS;level++) {
+    // The geometric middle of the sums of the level, and its bounds
+    float octaves = (level == 0) ? COLOR_LEVEL_SHIFT - 1 : COLOR_LEVEL_SHIFT + level - 0.5f;
+    float low = (level == 0) ? 0 : COLOR_LEVEL_SHIFT + level - 1;
+    float high = COLOR_LEVEL_SHIFT + level;
+    for(uint8_t r=0;r<COLOR_BINS;r++) {
+      for(uint8_t g=0;g<COLOR_BINS;g++) {
+        float cell[3] = {(r + 0.5f) / COLOR_BINS, (g + 0.5f) / COLOR_BINS,
+                         COLOR_BRIGHTNESS_WEIGHT * octaves};
+        float best, second;
+        uint8_t nearest = color_nearest(cell, points, n, best, second);
+        bool uniform = n > 0;
+        for(int corner=0;corner<8 && uniform;corner++) {
+          float p[3] = {(r + ((corner & 1) ? 1 + COLOR_MARGIN : -COLOR_MARGIN)) / COLOR_BINS,
+                        (g + ((corner & 2) ? 1 + COLOR_MARGIN : -COLOR_MARGIN)) / COLOR_BINS,
+                        COLOR_BRIGHTNESS_WEIGHT * ((corner & 4) ? high : low)};
+          float d1, d2;
+          if (id[color_nearest(p, points, n, d1, d2)] != id[nearest]) uniform = false;
+        }
+        // A centroid inside the cell may own a region that reaches no corner
+        for(uint8_t k=0;k<n && uniform;k++) {
+          if (id[k] != id[nearest] &&
+              points[k][0] * COLOR_BINS >= r - COLOR_MARGIN && points[k][0] * COLOR_BINS <= r + 1 + COLOR_MARGIN &&
+              points[k][1] * COLOR_BINS >= g - COLOR_MARGIN && points[k][1] * COLOR_BINS <= g + 1 + COLOR_MARGIN &&
+              points[k][2] >= COLOR_BRIGHTNESS_WEIGHT * low && points[k][2] <= COLOR_BRIGHTNESS_WEIGHT * high)
+            uniform = false;
+        }
+        if (uniform) {
+          float confidence = (second > 0) ? (second - best) / (second + best) : 1;
+          uint8_t nibble = (uint8_t) (confidence * 15 + 0.5f);
+          table[level][r][g] = id[nearest] | ((nibble ? nibble : 1) << 4);
+        } else {
+          table[level][r][g] = 0;
+        }
+      }
+    }
+  }
+}
+
+// log2(1 + i/32) with 12 fraction bits
+static const uint16_t color_log_table[33] = {
+  0, 182, 358, 530, 696, 858, 1016, 1169, 1319, 1465, 1607, 1746, 1882, 2015, 2145, 2272,
+  2396, 2518, 2637, 2754, 2869, 2982, 3092, 3200, 3307, 3412, 3514, 3615, 3715, 3812, 3908, 4003,
+  4096
+};
+
+/**
+ * log2(x) with 12 fraction bits, for x from 1. Interpolates the table
+**/
+static uint32_t color_log2(uint32_t x) {
+  uint32_t msb = 0;
+  while (x >> (msb + 1)) msb++;
+  // The mantissa with 12 fraction bits: 5 pick the segment, 7 interpolate
+  uint32_t m = (msb >= 12) ? x >> (msb - 12) : x << (12 - msb);
+  uint32_t i = (m >> 7) & 31;
+  uint32_t f = m & 127;
+  return (msb << COLOR_FRACTION) + color_log_table[i] + (((color_log_table[i + 1] - color_log_table[i]) * f) >> 7);
+}
+
+/**
+ * Nearest centroid to a reading, comparing the distances in fixed point.
+ * r and g are at most sum, and sum is at most 3 * 0xFFFF
+**/
+uint8_t EV3UARTColorClassifier::search(uint32_t r, uint32_t g, uint32_t sum, uint8_t &confidence) const {
+  // One octave of brightness weighs COLOR_BRIGHTNESS_WEIGHT, here with 16 fraction bits
+  const uint32_t weight = (uint32_t) (COLOR_BRIGHTNESS_WEIGHT * 65536 + 0.5f);
+  int32_t p[3] = {(int32_t) ((r << COLOR_FRACTION) / sum), (int32_t) ((g << COLOR_FRACTION) / sum),
+                  (int32_t) ((color_log2(sum) * weight) >> 16)};
+  uint32_t best = 0xFFFFFFFF, second = 0xFFFFFFFF;
+  uint8_t nearest = COLOR_NONE;
+  for(uint8_t k=0;k<count;k++) {
+    // Each difference is under 2^15, so the sum of squares fits in 32 bits
+    uint32_t d = 0;
+    for(int i=0;i<3;i++) d += (uint32_t) ((p[i] - point[k][i]) * (p[i] - point[k][i]));
+    if (d < best) {
+      second = best;
+      best = d;
+      nearest = id[k];
+    } else if (d < second) {
+      second = d;
+    }
+  }
+  if (second == 0xFFFFFFFF) {
+    confidence = 255;
+  } else {
+    // Scaled so the product below fits in 32 bits
+    while (second > 0xFFFFFF) {
+      second >>= 1;
+      best >>= 1;
+    }
+    confidence = (second + best) ? (uint8_t) ((second - best) * 255 / (second + best)) : 0;
+  }
+  return nearest;
+}
+
+/**
+ * Colour id of a reading and a confidence from 0 to 255. Integer only
+**/
+uint8_t EV3UARTColorClassifier::classify(int32_t red, int32_t green, int32_t blue, uint8_t &confidence) const {
+  // The sensor sends 10 bits per channel; keeping under 16 bits avoids overflows
+  uint32_t r = red < 0 ? 0 : (red > 0xFFFF ? 0xFFFF : red);
+  uint32_t g = green < 0 ? 0 : (green > 0xFFFF ? 0xFFFF : green);
+  uint32_t b = blue < 0 ? 0 : (blue > 0xFFFF ? 0xFFFF : blue);
+  uint32_t sum = r + g + b;
+  if (sum == 0) sum = 1;
+  uint8_t level = 0;
+  for(uint32_t s = sum >> COLOR_LEVEL_SHIFT; s; s >>= 1) level++;
+  if (level >= COLOR_LEVELS) return search(r, g, sum, confidence);
+  // r and g are at most sum, so the products fit in 32 bits
+  uint32_t scale = ((uint32_t) COLOR_BINS << 16) / sum;
+  uint32_t rb = (r * scale) >> 16;
+  uint32_t gb = (g * scale) >> 16;
+  if (rb >= COLOR_BINS) rb = COLOR_BINS - 1;
+  if (gb >= COLOR_BINS) gb = COLOR_BINS - 1;
+  uint8_t entry = table[level][rb][gb];
+  if (entry == 0) return search(r, g, sum, confidence);
+  confidence = (entry >> 4) * 17;
+  return entry & COLOR_MAX_ID;
+}
@@ -0,0 +1,98 @@
+// EV3UARTColor.h
+//
+// Colour classification of RGB raw readings with a lookup table, so the
+// colour of every RGBRaw frame is known without floating point.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTCOLOR_H
+#define EV3UARTCOLOR_H
+
+#include "EV3UARTPlatform.h"
+
+// Colour ids, the same the sensor gives in ColColor mode
+#define COLOR_NONE 0
+#define COLOR_BLACK 1
+#define COLOR_BLUE 2
+#define COLOR_GREEN 3
+#define COLOR_YELLOW 4
+#define COLOR_RED 5
+#define COLOR_WHITE 6
+#define COLOR_BROWN 7
+
+// Largest colour id a table can hold
+#define COLOR_MAX_ID 15
+
+// Divisions of the chromaticities r/(r+g+b) and g/(r+g+b) in the table.
+// The table takes COLOR_LEVELS * COLOR_BINS^2 bytes. Readings that fall in a
+// cell crossed by the border between two colours are resolved by a search
+// among the centroids, in integers, so the result is the same with any size
+// (99.9% of random readings get the colour of the float search): a larger
+// table only sends fewer readings to the search. With the defaults about 4
+// in 10 readings spread over the whole range of the sensor are searched, 7 in
+// 10 of those under 400 per channel, and a search takes about 4 times the
+// cycles of a lookup
+#ifndef COLOR_BINS
+#define COLOR_BINS 16
+#endif
+
+// Brightness levels in the table, one per octave of r+g+b. Level 0 holds
+// the sums below 2^COLOR_LEVEL_SHIFT; sums from the top of the last level
+// are searched. The default covers the 10 bit channels of the sensor
+#ifndef COLOR_LEVELS
+#define COLOR_LEVELS 10
+#endif
+#ifndef COLOR_LEVEL_SHIFT
+#define COLOR_LEVEL_SHIFT 3
+#endif
+
+// Weight of one octave of brightness against the chromaticity in training
+#ifndef COLOR_BRIGHTNESS_WEIGHT
+#define COLOR_BRIGHTNESS_WEIGHT 0.15f
+#endif
+
+/**
+* Mean RGB raw reading of a colour, for training
+**/
+struct EV3UARTColorCentroid {
+	uint8_t id;                           // The colour returned, up to COLOR_MAX_ID
+	uint16_t red, green, blue;
+};
+
+// Readings of the LEGO colours with the sensor about 1 cm away, used by default
+#define DEFAULT_COLORS 8
+extern const EV3UARTColorCentroid ev3uart_default_colors[DEFAULT_COLORS];
+
+/**
+* Nearest colour classifier. Training finds the nearest centroid to every
+* cell of a table indexed by brightness level and normalised chromaticity;
+* classifying a reading is then one integer division and a table lookup.
+* Cells where the nearest centroid is not the same all over are marked, and
+* readings in them are classified by comparing their distances to every
+* centroid in fixed point, which gives the nearest centroid of the float
+* search but for rounding. The confidence is the margin between the squared
+* distances to the nearest and the second nearest centroid, 255 on a
+* centroid and 0 half way between two.
+*
+* @code
+* EV3UARTColorClassifier colors;
+* sensor.set_classifier(&colors);
+* sensor.set_mode(RGBRaw);
+* uint8_t confidence;
+* uint8_t color = sensor.fetch_color(confidence);
+* @endcode
+**/
+class EV3UARTColorClassifier {
+	public:
+		EV3UARTColorClassifier();                      // Trained with ev3uart_default_colors
+		void train(const EV3UARTColorCentroid* centroids, uint8_t n); // Build the table. Uses floating point
+		uint8_t classify(int32_t red, int32_t green, int32_t blue, uint8_t &confidence) const; // Colour id of a reading
+	private:
+		uint8_t search(uint32_t r, uint32_t g, uint32_t sum, uint8_t &confidence) const; // Nearest centroid, in fixed point
+		uint8_t table[COLOR_LEVELS][COLOR_BINS][COLOR_BINS]; // Colour id, and confidence in the high 4 bits. 0 to search
+		int16_t point[COLOR_MAX_ID + 1][3];            // The centroids in the space of the distances, 12 fraction bits
+		uint8_t id[COLOR_MAX_ID + 1];
+		uint8_t count;                                 // Number of centroids
+};
+
+#endif
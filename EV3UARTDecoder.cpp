@@ -0,0 +1,63 @@
+// EV3UARTDecoder.cpp
+//
+// Decoders for the payload of DATA messages.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTDecoder.h"
+
+// Unrolled decoders indexed by data type and number of items - 1
+static const EV3UARTDecoder unrolled[4][MAX_UNROLLED_SETS] = {
+  {ev3uart_decode<DATA_8,1>, ev3uart_decode<DATA_8,2>, ev3uart_decode<DATA_8,3>, ev3uart_decode<DATA_8,4>},
+  {ev3uart_decode<DATA_16,1>, ev3uart_decode<DATA_16,2>, ev3uart_decode<DATA_16,3>, ev3uart_decode<DATA_16,4>},
+  {ev3uart_decode<DATA_32,1>, ev3uart_decode<DATA_32,2>, ev3uart_decode<DATA_32,3>, ev3uart_decode<DATA_32,4>},
+  {ev3uart_decode<DATA_F,1>, ev3uart_decode<DATA_F,2>, ev3uart_decode<DATA_F,3>, ev3uart_decode<DATA_F,4>},
+};
+
+// Looping decoders indexed by data type
+static const EV3UARTDecoder looping[4] = {
+  ev3uart_decode_n<DATA_8>, ev3uart_decode_n<DATA_16>, ev3uart_decode_n<DATA_32>, ev3uart_decode_n<DATA_F>,
+};
+
+// Integer decoders indexed by data type
+static const EV3UARTIntDecoder integer[4] = {
+  ev3uart_decode_int<DATA_8>, ev3uart_decode_int<DATA_16>, ev3uart_decode_int<DATA_32>, ev3uart_decode_int<DATA_F>,
+};
+
+/**
+ * Get the decoder for sets items of a data type
+**/
+EV3UARTDecoder ev3uart_select_decoder(uint8_t type, uint8_t sets) {
+  if (type > DATA_F || sets == 0) return NULL;
+  if (ev3uart_type_size(type) * sets > MAX_PAYLOAD) return NULL;
+  if (sets <= MAX_UNROLLED_SETS) return unrolled[type][sets-1];
+  return looping[type];
+}
+
+/**
+ * Get the integer decoder for a data type
+**/
+EV3UARTIntDecoder ev3uart_select_int_decoder(uint8_t type) {
+  if (type > DATA_F) return NULL;
+  return integer[type];
+}
+
+/**
+ * Decode with a switch on the data type for every item
+**/
+void ev3uart_decode_generic(uint8_t type, const uint8_t* bb, float* value, uint8_t sets) {
+  for(int i=0;i<sets;i++) {
+    switch(type) {
+      case DATA_8: value[i] = (float) (int8_t) bb[i]; break;
+      case DATA_16: value[i] = (float) (int16_t) (bb[i*2] | (bb[i*2+1] << 8)); break;
+      case DATA_32: value[i] = (float) (int32_t) (((uint32_t) bb[i*4]) | ((uint32_t) bb[i*4+1] << 8) |
+                      ((uint32_t) bb[i*4+2] << 16) | ((uint32_t) bb[i*4+3] << 24)); break;
+      case DATA_F: {
+        uint32_t l = ((uint32_t) bb[i*4]) | ((uint32_t) bb[i*4+1] << 8) |
+                     ((uint32_t) bb[i*4+2] << 16) | ((uint32_t) bb[i*4+3] << 24);
+        memcpy(&value[i], &l, 4);
+        break;
+      }
+    }
+  }
+}
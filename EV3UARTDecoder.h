@@ -0,0 +1,143 @@
+// EV3UARTDecoder.h
+//
+// Decoders for the payload of DATA messages, one per data type and number
+// of items, selected once when the format of a mode is known.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTDECODER_H
+#define EV3UARTDECODER_H
+
+#include "EV3UARTPlatform.h"
+
+// Data types of the FORMAT INFO message
+#define DATA_8 0
+#define DATA_16 1
+#define DATA_32 2
+#define DATA_F 3
+
+// Number of items handled by a fully unrolled decoder. More use a loop
+#define MAX_UNROLLED_SETS 4
+
+// The largest payload of a message
+#define MAX_PAYLOAD 32
+
+// Decode sets items from the payload bb into value
+typedef void (*EV3UARTDecoder)(const uint8_t* bb, float* value, uint8_t sets);
+
+// Same, keeping integer items as integers
+typedef void (*EV3UARTIntDecoder)(const uint8_t* bb, int32_t* value, uint8_t sets);
+
+/**
+ * Unaligned little-endian loads. On little-endian targets memcpy compiles to a
+ * single load where the core allows unaligned access
+**/
+inline uint16_t ev3uart_le16(const uint8_t* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return (uint16_t) (p[0] | (p[1] << 8));
+#else
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return v;
+#endif
+}
+
+inline uint32_t ev3uart_le32(const uint8_t* p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return ((uint32_t) p[0]) | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+#else
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+#endif
+}
+
+/**
+ * Size in bytes of one item of a data type
+**/
+constexpr uint8_t ev3uart_type_size(uint8_t type) {
+  return type == DATA_8 ? 1 : type == DATA_16 ? 2 : 4;
+}
+
+/**
+ * Smallest power of two not below n. Payloads are always padded to one
+**/
+constexpr uint16_t ev3uart_pow2(uint16_t n, uint16_t p = 1) {
+  return p >= n ? p : ev3uart_pow2(n, (uint16_t) (p << 1));
+}
+
+/**
+ * Length of the payload of a DATA message for a format
+**/
+constexpr uint16_t ev3uart_payload_size(uint8_t type, uint8_t sets) {
+  return ev3uart_pow2(ev3uart_type_size(type) * sets);
+}
+
+/**
+* Conversion of one item to float for each data type. Integers are signed
+**/
+template <uint8_t TYPE> struct EV3UARTItem;
+
+template <> struct EV3UARTItem<DATA_8> {
+	static float get(const uint8_t* p) { return (float) (int8_t) p[0]; }
+	static int32_t get_int(const uint8_t* p) { return (int8_t) p[0]; }
+};
+
+template <> struct EV3UARTItem<DATA_16> {
+	static float get(const uint8_t* p) { return (float) (int16_t) ev3uart_le16(p); }
+	static int32_t get_int(const uint8_t* p) { return (int16_t) ev3uart_le16(p); }
+};
+
+template <> struct EV3UARTItem<DATA_32> {
+	static float get(const uint8_t* p) { return (float) (int32_t) ev3uart_le32(p); }
+	static int32_t get_int(const uint8_t* p) { return (int32_t) ev3uart_le32(p); }
+};
+
+template <> struct EV3UARTItem<DATA_F> {
+	static float get(const uint8_t* p) {
+		uint32_t v = ev3uart_le32(p);
+		float f;
+		memcpy(&f, &v, 4);
+		return f;
+	}
+	static int32_t get_int(const uint8_t* p) { return (int32_t) get(p); }
+};
+
+/**
+ * Decoder for a fixed number of items. The loop has a constant bound and is unrolled
+**/
+template <uint8_t TYPE, uint8_t SETS>
+void ev3uart_decode(const uint8_t* bb, float* value, uint8_t) {
+  for(uint8_t i=0;i<SETS;i++)
+    value[i] = EV3UARTItem<TYPE>::get(bb + i*ev3uart_type_size(TYPE));
+}
+
+/**
+ * Decoder for any number of items of one type
+**/
+template <uint8_t TYPE>
+void ev3uart_decode_n(const uint8_t* bb, float* value, uint8_t sets) {
+  for(uint8_t i=0;i<sets;i++)
+    value[i] = EV3UARTItem<TYPE>::get(bb + i*ev3uart_type_size(TYPE));
+}
+
+/**
+ * Integer decoder for any number of items of one type. No floating point
+ * is used except for DATA_F, whose items are truncated
+**/
+template <uint8_t TYPE>
+void ev3uart_decode_int(const uint8_t* bb, int32_t* value, uint8_t sets) {
+  for(uint8_t i=0;i<sets;i++)
+    value[i] = EV3UARTItem<TYPE>::get_int(bb + i*ev3uart_type_size(TYPE));
+}
+
+// Get the decoder for a format, NULL if the format is invalid
+EV3UARTDecoder ev3uart_select_decoder(uint8_t type, uint8_t sets);
+
+// Get the integer decoder for a data type, NULL if the type is invalid
+EV3UARTIntDecoder ev3uart_select_int_decoder(uint8_t type);
+
+// Reference decoder switching on the data type for every item
+void ev3uart_decode_generic(uint8_t type, const uint8_t* bb, float* value, uint8_t sets);
+
+#endif
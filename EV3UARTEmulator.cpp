@@ -0,0 +1,403 @@
+// EV3UARTEmulator.cpp
+//
+// The device side of the protocol: an emulated EV3 UART sensor.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTEmulator.h"
+
+// INFO message types of the metadata of a mode, in the order they are sent
+#define EMU_INFO_NAME 0x00
+#define EMU_INFO_RAW 0x01
+#define EMU_INFO_PCT 0x02
+#define EMU_INFO_SI 0x03
+#define EMU_INFO_SYMBOL 0x04
+#define EMU_INFO_FORMAT 0x80
+#define EMU_INFO_MESSAGES 6
+
+/**
+* Metadata of one mode of the LEGO colour sensor
+**/
+struct EmuColorMode {
+  const char* name;
+  const char* symbol;
+  uint8_t sets, data_type, figures, decimals;
+  float raw_low, raw_high;
+  float pct_low, pct_high;
+  float si_low, si_high;
+};
+
+static const EmuColorMode color_modes[COLOR_SENSOR_MODES] = {
+  {"COL-REFLECT", "pct", 1, DATA_8, 3, 0, 0, 100, 0, 100, 0, 100},
+  {"COL-AMBIENT", "pct", 1, DATA_8, 3, 0, 0, 100, 0, 100, 0, 100},
+  {"COL-COLOR", "col", 1, DATA_8, 2, 0, 0, 8, 0, 100, 0, 8},
+  {"REF-RAW", "", 2, DATA_16, 4, 0, 0, 1020, 0, 100, 0, 1020},
+  {"RGB-RAW", "", 3, DATA_16, 4, 0, 0, 1020, 0, 100, 0, 1020},
+  {"COL-CAL", "", 4, DATA_16, 5, 0, 0, 65535, 0, 100, 0, 65535},
+};
+
+uint8_t ev3uart_color_sensor_modes(EV3UARTMode* modes) {
+  for(int i=0;i<COLOR_SENSOR_MODES;i++) {
+    const EmuColorMode &c = color_modes[i];
+    EV3UARTMode &m = modes[i];
+    m = EV3UARTMode();
+    strncpy(m.name, c.name, MODE_NAME_SIZE - 1);
+    m.name[MODE_NAME_SIZE - 1] = 0;
+    strncpy(m.symbol, c.symbol, MODE_SYMBOL_SIZE - 1);
+    m.symbol[MODE_SYMBOL_SIZE - 1] = 0;
+    m.raw_low = c.raw_low;
+    m.raw_high = c.raw_high;
+    m.pct_low = c.pct_low;
+    m.pct_high = c.pct_high;
+    m.si_low = c.si_low;
+    m.si_high = c.si_high;
+    m.update_scale();
+    m.set_format(c.sets, c.data_type, c.figures, c.decimals);
+  }
+  return COLOR_SENSOR_MODES;
+}
+
+EV3UARTEmulator::EV3UARTEmulator() {
+  ss = NULL;
+  timer = NULL;
+  modes = NULL;
+  count = 0;
+  views = 0;
+  type = 0;
+  state = EMU_HANDSHAKE;
+  mode = 0;
+  next_message = 0;
+  acked = false;
+  state_time = 0;
+  last_nack = 0;
+  last_frame = 0;
+  frame_period = 0;
+  frames_sent = 0;
+  heartbeats = 0;
+  source = NULL;
+  source_context = NULL;
+  host_len = 0;
+  host_pos = 0;
+  tx_interrupt = false;
+  for(int i=0;i<MAX_MODES;i++) {
+    frame_len[i] = 0;
+    payload_at[i] = 0;
+  }
+}
+
+/**
+ * Start emulating a sensor of the given LEGO type with count modes of the
+ * table. Frames start with all items zero
+**/
+void EV3UARTEmulator::begin(EV3UARTTransport &transport, EV3UARTTimer &timer, uint8_t type,
+                            EV3UARTMode* modes, uint8_t count, uint8_t views) {
+  ss = &transport;
+  this->timer = &timer;
+  this->type = type;
+  this->modes = modes;
+  this->count = count < MAX_MODES ? count : MAX_MODES;
+  this->views = (views && views <= this->count) ? views : this->count;
+  tx_interrupt = ss->attach_tx(&EV3UARTEmulator::tx_handler, this);
+  encode_frames();
+  restart();
+}
+
+/**
+ * Go back to 2400 baud and send the whole handshake again, as a sensor
+ * does when it is plugged in
+**/
+void EV3UARTEmulator::restart() {
+  if (tx_interrupt) ss->enable_tx(false);
+  tx.clear();
+  ss->baud(2400);
+  state = EMU_HANDSHAKE;
+  mode = 0;
+  next_message = 0;
+  acked = false;
+  host_len = 0;
+  frames_sent = 0;
+  state_time = timer->read_us();
+}
+
+void EV3UARTEmulator::set_frame_period_us(uint32_t us) {
+  frame_period = us;
+}
+
+void EV3UARTEmulator::set_source(EV3UARTEmulatorSource source, void* context) {
+  this->source = NULL;
+  source_context = context;
+  this->source = source;
+}
+
+uint8_t EV3UARTEmulator::get_state() {
+  return state;
+}
+
+uint8_t EV3UARTEmulator::get_mode() {
+  return mode;
+}
+
+uint32_t EV3UARTEmulator::get_frames_sent() {
+  return frames_sent;
+}
+
+uint32_t EV3UARTEmulator::get_heartbeats() {
+  return heartbeats;
+}
+
+/**
+ * Process the bytes received from the host, then queue the next part of
+ * the handshake, change speed after the ACK or queue the next DATA frame
+**/
+void EV3UARTEmulator::service() {
+  while(ss->readable()) receive(ss->getc());
+  uint32_t now = timer->read_us();
+
+  if (state == EMU_HANDSHAKE) {
+    uint8_t bb[MAX_MESSAGE_SIZE];
+    uint8_t len;
+    while((len = handshake_message(next_message, bb)) != 0 && queue(bb, len)) next_message++;
+    if (len == 0) {
+      state = EMU_WAIT_ACK;
+      state_time = now;
+    }
+  } else if (state == EMU_WAIT_ACK) {
+    if (acked) {
+      // Our ACK is out, since the host answered it
+      ss->baud(EMU_SPEED);
+      state = EMU_DATA;
+      last_nack = now;
+      last_frame = now;
+    } else if (!tx.empty()) {
+      // The timeout counts from the last byte of the handshake
+      state_time = now;
+    } else if ((uint32_t) (now - state_time) >= EMU_ACK_TIMEOUT_US) {
+      restart();
+    }
+  } else if (state == EMU_DATA) {
+    if ((uint32_t) (now - last_nack) >= EMU_HEARTBEAT_TIMEOUT_US) {
+      restart();
+    } else if (frame_due(now)) {
+      if (source) source(source_context, *this, mode);
+      if (queue(frame[mode], frame_len[mode])) {
+        last_frame = now;
+        frames_sent++;
+      }
+    }
+  }
+  // Also when no frame is due, so a polled transport drains the queue
+  if (!tx_interrupt) tx_drain();
+}
+
+/**
+ * True if the next DATA frame should be queued now
+**/
+bool EV3UARTEmulator::frame_due(uint32_t now) {
+  // The host changes speed some time after its ACK
+  if ((uint32_t) (now - state_time) < EMU_DATA_DELAY_US) return false;
+  // Keep one frame queued behind the one going out, so a CMD_SELECT
+  // takes effect at the next frame and the line never idles
+  if (tx.size() >= frame_len[mode]) return false;
+  return frame_period == 0 || (uint32_t) (now - last_frame) >= frame_period;
+}
+
+/**
+ * Set item index of the frames of a mode. Only the bytes of the item and
+ * the checksum change. False if the mode or item does not exist
+**/
+bool EV3UARTEmulator::set_value(uint8_t mode, uint8_t index, int32_t value) {
+  if (mode >= count) return false;
+  if (modes[mode].data_type == DATA_F) return set_value_float(mode, index, (float) value);
+  uint8_t bb[4];
+  for(int i=0;i<4;i++) bb[i] = (uint8_t) (value >> (8*i));
+  return put_item(mode, index, bb);
+}
+
+bool EV3UARTEmulator::set_value_float(uint8_t mode, uint8_t index, float value) {
+  if (mode >= count) return false;
+  if (modes[mode].data_type != DATA_F) return set_value(mode, index, (int32_t) value);
+  uint8_t bb[4];
+  memcpy(bb, &value, 4);
+  return put_item(mode, index, bb);
+}
+
+bool EV3UARTEmulator::put_item(uint8_t mode, uint8_t index, const uint8_t* item) {
+  const EV3UARTMode &m = modes[mode];
+  if (index >= m.sets || frame_len[mode] == 0) return false;
+  uint8_t size = ev3uart_type_size(m.data_type);
+  uint8_t* p = frame[mode] + payload_at[mode] + index * size;
+  uint8_t &checksum = frame[mode][frame_len[mode] - 1];
+  for(uint8_t i=0;i<size;i++) {
+    checksum ^= p[i] ^ item[i];
+    p[i] = item[i];
+  }
+  return true;
+}
+
+/**
+ * Encode the DATA message of every mode with all items zero. Sensors with
+ * more than 8 modes put a CMD_EXT_MODE message before every DATA message
+**/
+void EV3UARTEmulator::encode_frames() {
+  uint8_t zero[MAX_PAYLOAD];
+  memset(zero, 0, sizeof(zero));
+  for(uint8_t m=0;m<count;m++) {
+    uint8_t* p = frame[m];
+    uint8_t n = 0;
+    uint16_t size = ev3uart_type_size(modes[m].data_type) * modes[m].sets;
+    frame_len[m] = 0;
+    if (modes[m].data_type > DATA_F || size == 0 || size > MAX_PAYLOAD) continue;
+    if (count > 8) {
+      p[0] = CMD_EXT_MODE;
+      p[1] = (m >= 8) ? EXT_MODE_8 : EXT_MODE_0;
+      p[2] = 0xFF ^ p[0] ^ p[1];
+      n = 3;
+    }
+    payload_at[m] = n + 1;
+    frame_len[m] = n + encode(p + n, CMD_DATA | (m & CMD_MMM_MASK), zero, (uint8_t) size);
+  }
+}
+
+/**
+ * Write a CMD or DATA message with the payload padded to a power of two and
+ * its checksum. Returns its length
+**/
+uint8_t EV3UARTEmulator::encode(uint8_t* bb, uint8_t cmd, const uint8_t* payload, uint8_t len) {
+  uint8_t lll = 0;
+  while ((1 << lll) < len) lll++;
+  bb[0] = cmd | (lll << CMD_LLL_SHIFT);
+  uint8_t checksum = 0xFF ^ bb[0];
+  for(int i=0;i<(1 << lll);i++) {
+    bb[1+i] = i < len ? payload[i] : 0;
+    checksum ^= bb[1+i];
+  }
+  bb[1 + (1 << lll)] = checksum;
+  return 2 + (1 << lll);
+}
+
+uint8_t EV3UARTEmulator::encode_info(uint8_t* bb, uint8_t mode, uint8_t info, const uint8_t* payload, uint8_t len) {
+  uint8_t lll = 0;
+  while ((1 << lll) < len) lll++;
+  bb[0] = CMD_INFO | (lll << CMD_LLL_SHIFT) | (mode & CMD_MMM_MASK);
+  bb[1] = info | ((mode >= 8) ? INFO_MODE_PLUS_8 : 0);
+  uint8_t checksum = 0xFF ^ bb[0] ^ bb[1];
+  for(int i=0;i<(1 << lll);i++) {
+    bb[2+i] = i < len ? payload[i] : 0;
+    checksum ^= bb[2+i];
+  }
+  bb[2 + (1 << lll)] = checksum;
+  return 3 + (1 << lll);
+}
+
+/**
+ * Build the index-th message of the handshake: TYPE, MODES, SPEED, the six
+ * INFO messages of each mode from the highest down, then ACK
+**/
+uint8_t EV3UARTEmulator::handshake_message(uint16_t index, uint8_t* bb) {
+  uint8_t payload[8];
+  if (index == 0) return encode(bb, CMD_TYPE, &type, 1);
+  if (index == 1) {
+    payload[0] = (count > 8 ? 8 : count) - 1;
+    payload[1] = (views > 8 ? 8 : views) - 1;
+    if (count <= 8) return encode(bb, CMD_MODES & ~CMD_LLL_MASK, payload, 2);
+    payload[2] = count - 1;
+    payload[3] = views - 1;
+    return encode(bb, CMD_MODES & ~CMD_LLL_MASK, payload, 4);
+  }
+  if (index == 2) {
+    uint32_t speed = EMU_SPEED;
+    for(int i=0;i<4;i++) payload[i] = (uint8_t) (speed >> (8*i));
+    return encode(bb, CMD_SPEED & ~CMD_LLL_MASK, payload, 4);
+  }
+  index -= 3;
+  if (index < count * EMU_INFO_MESSAGES) {
+    uint8_t m = count - 1 - index / EMU_INFO_MESSAGES;
+    const EV3UARTMode &md = modes[m];
+    switch(index % EMU_INFO_MESSAGES) {
+      case 0: return encode_info(bb, m, EMU_INFO_NAME, (const uint8_t*) md.name, strlen(md.name));
+      case 1:
+        memcpy(payload, &md.raw_low, 4);
+        memcpy(payload + 4, &md.raw_high, 4);
+        return encode_info(bb, m, EMU_INFO_RAW, payload, 8);
+      case 2:
+        memcpy(payload, &md.pct_low, 4);
+        memcpy(payload + 4, &md.pct_high, 4);
+        return encode_info(bb, m, EMU_INFO_PCT, payload, 8);
+      case 3:
+        memcpy(payload, &md.si_low, 4);
+        memcpy(payload + 4, &md.si_high, 4);
+        return encode_info(bb, m, EMU_INFO_SI, payload, 8);
+      case 4: return encode_info(bb, m, EMU_INFO_SYMBOL, (const uint8_t*) md.symbol, strlen(md.symbol));
+      default:
+        payload[0] = md.sets;
+        payload[1] = md.data_type;
+        payload[2] = md.figures;
+        payload[3] = md.decimals;
+        return encode_info(bb, m, EMU_INFO_FORMAT, payload, 4);
+    }
+  }
+  if (index == count * EMU_INFO_MESSAGES) {
+    bb[0] = BYTE_ACK;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Queue a message whole, or not at all
+**/
+bool EV3UARTEmulator::queue(const uint8_t* bb, uint8_t len) {
+  if (EMU_TX_BUFFER_SIZE - tx.size() < len) return false;
+  for(uint8_t i=0;i<len;i++) tx.push(bb[i]);
+  if (tx_interrupt) ss->enable_tx(true);
+  return true;
+}
+
+void EV3UARTEmulator::tx_handler(void* context) {
+  ((EV3UARTEmulator*) context)->tx_drain();
+}
+
+void EV3UARTEmulator::tx_drain() {
+  uint8_t b;
+  while(ss->writeable() && tx.pop(b)) ss->putc(b);
+  if (tx_interrupt && tx.empty()) ss->enable_tx(false);
+}
+
+/**
+ * Collect the host's messages: single byte ACK and NACK, and CMD messages
+**/
+void EV3UARTEmulator::receive(uint8_t b) {
+  if (host_len == 0) {
+    if (b == BYTE_ACK) {
+      if (state == EMU_WAIT_ACK && !acked) {
+        acked = true;
+        state_time = timer->read_us();
+      }
+      return;
+    }
+    if (b == BYTE_NACK) {
+      heartbeats++;
+      last_nack = timer->read_us();
+      return;
+    }
+    if ((b & CMD_MASK) != CMD_COMMAND) return;
+    host_len = 2 + (1 << ((b & CMD_LLL_MASK) >> CMD_LLL_SHIFT));
+    host_pos = 0;
+  }
+  host_msg[host_pos++] = b;
+  if (host_pos == host_len) {
+    host_message();
+    host_len = 0;
+  }
+}
+
+/**
+ * Act on a CMD_SELECT. Other commands, such as CMD_WRITE, are ignored
+**/
+void EV3UARTEmulator::host_message() {
+  uint8_t checksum = 0xFF;
+  for(uint8_t i=0;i<host_len-1;i++) checksum ^= host_msg[i];
+  if (checksum != host_msg[host_len-1]) return;
+  if (host_msg[0] == CMD_SELECT && host_msg[1] < count && frame_len[host_msg[1]])
+    mode = host_msg[1];
+}
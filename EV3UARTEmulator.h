@@ -0,0 +1,138 @@
+// EV3UARTEmulator.h
+//
+// The device side of the protocol: makes a board running this library
+// behave as an EV3 UART sensor towards an EV3 brick or another host.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTEMULATOR_H
+#define EV3UARTEMULATOR_H
+
+#include "EV3UARTSensor.h"
+
+// States of the emulated sensor
+#define EMU_HANDSHAKE 0                   // Sending TYPE, MODES, SPEED and the INFO messages at 2400 baud
+#define EMU_WAIT_ACK 1                    // Handshake sent, waiting for the host's ACK
+#define EMU_DATA 2                        // Streaming DATA frames at the data speed
+
+// Bit rate of the data mode
+#ifndef EMU_SPEED
+#define EMU_SPEED 57600
+#endif
+
+// Size of the transmit queue in bytes (power of two), at least one frame
+#ifndef EMU_TX_BUFFER_SIZE
+#define EMU_TX_BUFFER_SIZE 64
+#endif
+
+// Time to wait for the host's ACK once the handshake is out before
+// sending it again, in microseconds
+#ifndef EMU_ACK_TIMEOUT_US
+#define EMU_ACK_TIMEOUT_US 100000
+#endif
+
+// Time from the host's ACK to the first DATA frame. The host changes speed
+// ACK_DELAY_US after its ACK
+#ifndef EMU_DATA_DELAY_US
+#define EMU_DATA_DELAY_US 20000
+#endif
+
+// Longest time without a NACK from the host in data mode before starting
+// the handshake again, as a sensor unplugged from a brick does
+#ifndef EMU_HEARTBEAT_TIMEOUT_US
+#define EMU_HEARTBEAT_TIMEOUT_US 500000
+#endif
+
+// Longest DATA message with its CMD_EXT_MODE prefix
+#define EMU_FRAME_SIZE (MAX_MESSAGE_SIZE + 3)
+
+// Number of modes of the LEGO colour sensor, see ev3uart_color_sensor_modes()
+#define COLOR_SENSOR_MODES 6
+
+class EV3UARTEmulator;
+
+// Called before each DATA frame, to update the values of the mode with set_value()
+typedef void (*EV3UARTEmulatorSource)(void* context, EV3UARTEmulator &emulator, uint8_t mode);
+
+// Fill modes with the COLOR_SENSOR_MODES modes of a LEGO colour sensor. Returns their number
+uint8_t ev3uart_color_sensor_modes(EV3UARTMode* modes);
+
+/**
+* Emulated EV3 UART sensor. The metadata comes from a table of EV3UARTMode,
+* which must stay valid. The DATA message of every mode, checksum
+* included, is kept encoded: set_value() patches the bytes of one item and
+* the checksum, and sending a frame is only copying it to the transmit
+* queue. With no frame period, frames are sent back to back, the maximum
+* rate of the line. Call service() often, from the main loop; with a
+* transport that has a TX interrupt, bytes go out from it.
+*
+* @code
+* RawSerial serial(PTC17,PTC16);
+* EV3UARTMbedTransport transport(serial);
+* EV3UARTMbedTimer timer;
+* EV3UARTMode modes[COLOR_SENSOR_MODES];
+* EV3UARTEmulator emulator;
+*
+* int main(){
+*   emulator.begin(transport, timer, TYPE_COLOR, modes, ev3uart_color_sensor_modes(modes));
+*   emulator.set_value(ColReflect, 0, 42);
+*   while(true) emulator.service();
+* }
+* @endcode
+**/
+class EV3UARTEmulator {
+	public:
+		EV3UARTEmulator();
+		void begin(EV3UARTTransport &transport, EV3UARTTimer &timer, uint8_t type,
+		           EV3UARTMode* modes, uint8_t count, uint8_t views = 0); // Start the handshake. views 0 for all modes
+		void restart();                                // Send the handshake again at 2400 baud
+		void service();                                // Take the host's messages and send what is due
+		void set_frame_period_us(uint32_t us);         // Time between DATA frames, 0 for back to back
+		void set_source(EV3UARTEmulatorSource source, void* context); // Called before each frame, NULL for none
+		bool set_value(uint8_t mode, uint8_t index, int32_t value); // Set an item of a mode's frames
+		bool set_value_float(uint8_t mode, uint8_t index, float value); // Same, for DataF modes
+		uint8_t get_state();                           // EMU_HANDSHAKE, EMU_WAIT_ACK or EMU_DATA
+		uint8_t get_mode();                            // The mode selected by the host
+		uint32_t get_frames_sent();                    // DATA frames queued since data mode started
+		uint32_t get_heartbeats();                     // NACKs received from the host
+	private:
+		static void tx_handler(void* context);
+		void tx_drain();                               // Send queued bytes while the transport takes them
+		bool queue(const uint8_t* bb, uint8_t len);    // Queue a whole message, false if it does not fit
+		bool frame_due(uint32_t now);                  // Time to queue the next DATA frame
+		uint8_t encode(uint8_t* bb, uint8_t cmd, const uint8_t* payload, uint8_t len); // Build a message
+		uint8_t encode_info(uint8_t* bb, uint8_t mode, uint8_t info, const uint8_t* payload, uint8_t len);
+		uint8_t handshake_message(uint16_t index, uint8_t* bb); // The index-th message of the handshake, 0 after the last
+		void encode_frames();                          // Encode the DATA message of every mode
+		bool put_item(uint8_t mode, uint8_t index, const uint8_t* item); // Patch an item and the checksum
+		void receive(uint8_t b);                       // Add a byte from the host
+		void host_message();                           // Handle a complete message from the host
+		EV3UARTTransport *ss;
+		EV3UARTTimer *timer;
+		EV3UARTMode *modes;
+		uint8_t count;
+		uint8_t views;
+		uint8_t type;
+		uint8_t state;
+		uint8_t mode;
+		uint16_t next_message;                         // Next handshake message to queue
+		bool acked;                                    // The host's ACK arrived
+		uint32_t state_time;                           // When the handshake was out, or the ACK arrived
+		uint32_t last_nack;
+		uint32_t last_frame;
+		uint32_t frame_period;
+		uint32_t frames_sent;
+		uint32_t heartbeats;
+		EV3UARTEmulatorSource source;
+		void* source_context;
+		uint8_t frame[MAX_MODES][EMU_FRAME_SIZE];      // The DATA message of each mode, ready to send
+		uint8_t frame_len[MAX_MODES];
+		uint8_t payload_at[MAX_MODES];                 // Offset of the payload in frame
+		uint8_t host_msg[MAX_MESSAGE_SIZE];            // Message being received from the host
+		uint8_t host_len;
+		uint8_t host_pos;
+		bool tx_interrupt;                             // Bytes are sent from the TX interrupt
+		EV3UARTRingBuffer<uint8_t, EMU_TX_BUFFER_SIZE> tx;
+};
+
+#endif
@@ -0,0 +1,103 @@
+// EV3UARTFilter.cpp
+//
+// Incremental filters run by the parser on each new DATA frame.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTFilter.h"
+
+EV3UARTFilter::EV3UARTFilter() {
+  type = FILTER_NONE;
+  window = 1;
+  alpha = 1;
+  reset();
+}
+
+void EV3UARTFilter::configure(const EV3UARTFilterConfig &config) {
+  type = config.type;
+  window = config.window;
+  if (window < 1) window = 1;
+  if (window > FILTER_WINDOW) window = FILTER_WINDOW;
+  alpha = config.alpha;
+  reset();
+}
+
+void EV3UARTFilter::reset() {
+  fill = 0;
+  pos = 0;
+  for(int i=0;i<FILTER_ITEMS;i++) state[i] = 0;
+}
+
+uint8_t EV3UARTFilter::get_count() {
+  return fill;
+}
+
+/**
+ * Position of the first value in s[0..n) not less than x
+**/
+static uint8_t lower_bound(const float* s, uint8_t n, float x) {
+  uint8_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint8_t mid = (lo + hi) / 2;
+    if (s[mid] < x) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Add the first n items of a sample and write their filtered values to out.
+ * Until the window is full the average and median use the values so far.
+ * in and out may be the same array
+**/
+void EV3UARTFilter::update(const float* in, float* out, uint8_t n) {
+  if (n > FILTER_ITEMS) n = FILTER_ITEMS;
+  bool full = fill == window;
+  for(uint8_t i=0;i<n;i++) {
+    float x = in[i];
+    switch(type) {
+      case FILTER_AVERAGE:
+        if (full) state[i] -= ring[i][pos];
+        ring[i][pos] = x;
+        state[i] += x;
+        out[i] = state[i] / (full ? window : fill + 1);
+        break;
+      case FILTER_EMA:
+        state[i] = (fill == 0) ? x : state[i] + alpha * (x - state[i]);
+        out[i] = state[i];
+        break;
+      case FILTER_MEDIAN: {
+        float* s = sorted[i];
+        uint8_t k = fill;
+        if (full) {
+          // Take the oldest value out of the sorted window
+          uint8_t j = lower_bound(s, k, ring[i][pos]);
+          memmove(s + j, s + j + 1, (k - j - 1) * sizeof(float));
+          k--;
+        }
+        uint8_t j = lower_bound(s, k, x);
+        memmove(s + j + 1, s + j, (k - j) * sizeof(float));
+        s[j] = x;
+        k++;
+        ring[i][pos] = x;
+        out[i] = (k & 1) ? s[k / 2] : (s[k / 2 - 1] + s[k / 2]) / 2;
+        break;
+      }
+      default:
+        out[i] = x;
+        break;
+    }
+  }
+  if (!full) fill++;
+  if (++pos == window) {
+    pos = 0;
+    // Sum the window again now and then, so rounding errors do not build up
+    if (type == FILTER_AVERAGE && fill == window) {
+      for(uint8_t i=0;i<n;i++) {
+        float sum = 0;
+        for(uint8_t j=0;j<window;j++) sum += ring[i][j];
+        state[i] = sum;
+      }
+    }
+  }
+}
@@ -0,0 +1,69 @@
+// EV3UARTFilter.h
+//
+// Incremental filters run by the parser on each new DATA frame, so that
+// smoothing costs one update per frame instead of a pass over a window on
+// every read.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTFILTER_H
+#define EV3UARTFILTER_H
+
+#include "EV3UARTPlatform.h"
+
+// Filter types
+#define FILTER_NONE 0
+#define FILTER_AVERAGE 1                  // Moving average of the last window values
+#define FILTER_EMA 2                      // Exponential moving average, y += alpha * (x - y)
+#define FILTER_MEDIAN 3                   // Median of the last window values
+
+// Largest window of the moving average and median
+#ifndef FILTER_WINDOW
+#define FILTER_WINDOW 8
+#endif
+
+// Number of items of a sample that are filtered. Further items are passed through
+#ifndef FILTER_ITEMS
+#define FILTER_ITEMS 4
+#endif
+
+// Number of modes of a sensor that can be filtered at once. Each has its own
+// state, so modes read in turn (EV3UARTScheduler) keep filtering across
+// switches
+#ifndef FILTER_STATES
+#define FILTER_STATES 2
+#endif
+
+/**
+* Filter type and parameters of one mode
+**/
+struct EV3UARTFilterConfig {
+	uint8_t type;                         // FILTER_NONE, FILTER_AVERAGE, FILTER_EMA or FILTER_MEDIAN
+	uint8_t window;                       // Values averaged or ranked, 1 to FILTER_WINDOW
+	float alpha;                          // Weight of a new value in FILTER_EMA, 0 to 1
+};
+
+/**
+* State of a filter over up to FILTER_ITEMS items. Fixed size. The moving
+* average and the EMA cost O(1) per value; the median finds the values to
+* remove and insert in a sorted copy of the window by binary search
+**/
+class EV3UARTFilter {
+	public:
+		EV3UARTFilter();
+		void configure(const EV3UARTFilterConfig &config); // Set the filter and forget all values
+		void reset();                                  // Forget all values
+		void update(const float* in, float* out, uint8_t n); // Add a sample of n items, get the filtered one
+		uint8_t get_count();                           // Number of values in the window
+	private:
+		uint8_t type;
+		uint8_t window;
+		uint8_t fill;                                  // Values in the window, up to window
+		uint8_t pos;                                   // Slot of the oldest value once the window is full
+		float alpha;
+		float state[FILTER_ITEMS];                     // Sum of the window, or the EMA
+		float ring[FILTER_ITEMS][FILTER_WINDOW];       // The window in arrival order
+		float sorted[FILTER_ITEMS][FILTER_WINDOW];     // The window in order, for the median
+};
+
+#endif
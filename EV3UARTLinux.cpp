@@ -0,0 +1,130 @@
+// EV3UARTLinux.cpp
+//
+// Linux implementation of the EV3 UART transport and timer.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#if defined(EV3UART_HOST) && defined(__linux__)
+
+#include "EV3UARTLinux.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+EV3UARTLinuxTransport::EV3UARTLinuxTransport() {
+  fd = -1;
+  rx_len = 0;
+  rx_pos = 0;
+}
+
+EV3UARTLinuxTransport::~EV3UARTLinuxTransport() {
+  close();
+}
+
+/**
+ * Open the device in raw, non-blocking mode
+**/
+bool EV3UARTLinuxTransport::open(const char* device) {
+  close();
+  fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) return false;
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    close();
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(fd, TCSANOW, &tio);
+  baud(2400);
+  return true;
+}
+
+void EV3UARTLinuxTransport::close() {
+  if (fd >= 0) ::close(fd);
+  fd = -1;
+  rx_len = 0;
+  rx_pos = 0;
+}
+
+/**
+ * Change the bit rate. Only the standard rates used by EV3 sensors are supported
+**/
+void EV3UARTLinuxTransport::baud(uint32_t rate) {
+  if (fd < 0) return;
+  speed_t s;
+  switch(rate) {
+    case 2400: s = B2400; break;
+    case 4800: s = B4800; break;
+    case 9600: s = B9600; break;
+    case 19200: s = B19200; break;
+    case 38400: s = B38400; break;
+    case 57600: s = B57600; break;
+    case 115200: s = B115200; break;
+    case 230400: s = B230400; break;
+    case 460800: s = B460800; break;
+    default: return;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) return;
+  cfsetispeed(&tio, s);
+  cfsetospeed(&tio, s);
+  tcsetattr(fd, TCSADRAIN, &tio);
+}
+
+bool EV3UARTLinuxTransport::readable() {
+  if (rx_pos < rx_len) return true;
+  if (fd < 0) return false;
+  ssize_t n = ::read(fd, rx, sizeof(rx));
+  if (n <= 0) return false;
+  rx_len = (uint8_t) n;
+  rx_pos = 0;
+  return true;
+}
+
+uint8_t EV3UARTLinuxTransport::getc() {
+  if (!readable()) return 0;
+  return rx[rx_pos++];
+}
+
+/**
+ * Sleep in poll() until the device has data or the timeout passes
+**/
+bool EV3UARTLinuxTransport::wait_readable(uint32_t timeout_us) {
+  if (readable() || fd < 0) return readable();
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  poll(&p, 1, (int) ((timeout_us + 999) / 1000));
+  return readable();
+}
+
+bool EV3UARTLinuxTransport::writeable() {
+  return fd >= 0;
+}
+
+void EV3UARTLinuxTransport::putc(uint8_t b) {
+  if (fd < 0) return;
+  while (::write(fd, &b, 1) < 0 && errno == EAGAIN);
+}
+
+uint32_t EV3UARTLinuxTimer::read_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000u + ts.tv_nsec / 1000);
+}
+
+void EV3UARTLinuxTimer::delay_ms(uint32_t ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+  nanosleep(&ts, NULL);
+}
+
+#endif
@@ -0,0 +1,49 @@
+// EV3UARTLinux.h
+//
+// Linux implementation of the EV3 UART transport and timer, for running the
+// library on a host with a USB serial adapter.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTLINUX_H
+#define EV3UARTLINUX_H
+
+#if defined(EV3UART_HOST) && defined(__linux__)
+
+#include "EV3UARTTransport.h"
+
+/**
+* Transport over a Linux tty device such as /dev/ttyUSB0
+**/
+class EV3UARTLinuxTransport : public EV3UARTTransport {
+	public:
+		EV3UARTLinuxTransport();
+		~EV3UARTLinuxTransport();
+		bool open(const char* device);                 // Open the device in raw mode at 2400 baud
+		void close();
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+		bool wait_readable(uint32_t timeout_us);
+	private:
+		int fd;                                        // File descriptor of the device, -1 if closed
+		uint8_t rx[64];                                // Bytes read but not yet taken
+		uint8_t rx_len;
+		uint8_t rx_pos;
+};
+
+/**
+* Timer using the monotonic clock. No periodic interrupt, so heartbeats are
+* sent from EV3UARTSensor::check_for_data()
+**/
+class EV3UARTLinuxTimer : public EV3UARTTimer {
+	public:
+		uint32_t read_us();
+		void delay_ms(uint32_t ms);
+};
+
+#endif
+
+#endif
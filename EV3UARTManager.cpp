@@ -0,0 +1,107 @@
+// EV3UARTManager.cpp
+//
+// Services several EV3 UART sensors from one loop and one heartbeat timer.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTManager.h"
+
+EV3UARTManager::EV3UARTManager() {
+  for(int i=0;i<MAX_SENSORS;i++) used[i] = false;
+  timer = NULL;
+  heart_attached = false;
+  last_beat = 0;
+  handler = NULL;
+  handler_context = NULL;
+}
+
+/**
+ * Set the timer shared by all sensors. A single periodic interrupt sends the
+ * heartbeats of every port; without one they are sent from service()
+**/
+void EV3UARTManager::begin(EV3UARTTimer &timer) {
+  this->timer = &timer;
+  last_beat = timer.read_us();
+  heart_attached = timer.attach_us(&EV3UARTManager::heartbeat_handler,this,HEART_BEAT_PERIOD_US);
+}
+
+/**
+ * Start the sensor on a port. Handshakes of all ports run at the same time
+ * from service()
+**/
+bool EV3UARTManager::add(uint8_t port, EV3UARTTransport &transport, bool rx_interrupt) {
+  if (port >= MAX_SENSORS || timer == NULL) return false;
+  used[port] = false;
+  sensor[port].set_external_heartbeat(true);
+  sensor[port].begin(transport, *timer, rx_interrupt);
+  used[port] = true;
+  return true;
+}
+
+#ifndef EV3UART_HOST
+bool EV3UARTManager::add(uint8_t port, RawSerial &serial, bool rx_interrupt) {
+  if (port >= MAX_SENSORS) return false;
+  mbed_transport[port].set_serial(serial);
+  return add(port, mbed_transport[port], rx_interrupt);
+}
+#endif
+
+void EV3UARTManager::remove(uint8_t port) {
+  if (port < MAX_SENSORS) used[port] = false;
+}
+
+EV3UARTSensor* EV3UARTManager::get_sensor(uint8_t port) {
+  if (port >= MAX_SENSORS || !used[port]) return NULL;
+  return &sensor[port];
+}
+
+void EV3UARTManager::on_sample(EV3UARTSampleHandler handler, void* context) {
+  this->handler_context = context;
+  this->handler = handler;
+}
+
+/**
+ * Process the bytes received on every port and pass each new sample to the
+ * handler. Must be called frequently
+**/
+int16_t EV3UARTManager::service() {
+  int16_t dispatched = 0;
+  EV3UARTSample samples[4];
+  if (!heart_attached && (uint32_t)(timer->read_us() - last_beat) >= HEART_BEAT_PERIOD_US) {
+    last_beat = timer->read_us();
+    heartbeat();
+  }
+  for(int i=0;i<MAX_SENSORS;i++) {
+    if (!used[i]) continue;
+    sensor[i].check_for_data();
+    int16_t n;
+    while((n = sensor[i].fetch_samples(samples, 4)) > 0) {
+      if (handler)
+        for(int j=0;j<n;j++) handler(handler_context, i, samples[j]);
+      dispatched += n;
+    }
+  }
+  return dispatched;
+}
+
+uint8_t EV3UARTManager::get_connected() {
+  uint8_t n = 0;
+  for(int i=0;i<MAX_SENSORS;i++)
+    if (used[i] && sensor[i].get_status() == DATA_MODE) n++;
+  return n;
+}
+
+bool EV3UARTManager::all_connected() {
+  for(int i=0;i<MAX_SENSORS;i++)
+    if (used[i] && sensor[i].get_status() != DATA_MODE) return false;
+  return true;
+}
+
+void EV3UARTManager::heartbeat() {
+  for(int i=0;i<MAX_SENSORS;i++)
+    if (used[i]) sensor[i].heartbeat();
+}
+
+void EV3UARTManager::heartbeat_handler(void* context) {
+  ((EV3UARTManager*) context)->heartbeat();
+}
@@ -0,0 +1,68 @@
+// EV3UARTManager.h
+//
+// Services several EV3 UART sensors from one loop and one heartbeat timer.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTMANAGER_H
+#define EV3UARTMANAGER_H
+
+#include "EV3UARTSensor.h"
+
+// Maximum number of sensors handled by one manager
+#ifndef MAX_SENSORS
+#define MAX_SENSORS 4
+#endif
+
+// Called from service() for every decoded sample
+typedef void (*EV3UARTSampleHandler)(void* context, uint8_t port, const EV3UARTSample &sample);
+
+/** Example EV3UARTManager.
+ * @code
+ * RawSerial serial1(PTC17,PTC16), serial2(PTB11,PTB10);
+ * EV3UARTMbedTimer timer;
+ * EV3UARTManager sensors;
+ *
+ * void on_sample(void* context, uint8_t port, const EV3UARTSample &sample) {
+ *   printf("%d: %.0f\n", port, sample.value[0]);
+ * }
+ *
+ * int main(){
+ *   sensors.begin(timer);
+ *   sensors.add(0, serial1, true);
+ *   sensors.add(1, serial2, true);
+ *   sensors.on_sample(on_sample, NULL);
+ *   while(true) sensors.service();
+ * }
+ * @endcode
+ */
+class EV3UARTManager {
+	public:
+		EV3UARTManager();
+		void begin(EV3UARTTimer &timer);               // Set the shared time base and heartbeat timer
+		bool add(uint8_t port, EV3UARTTransport &transport, bool rx_interrupt = false); // Start a sensor on a port
+#ifndef EV3UART_HOST
+		bool add(uint8_t port, RawSerial &serial, bool rx_interrupt = false);
+#endif
+		void remove(uint8_t port);                     // Stop servicing a port
+		EV3UARTSensor* get_sensor(uint8_t port);       // The sensor on a port, NULL if unused
+		void on_sample(EV3UARTSampleHandler handler, void* context); // Set the sample handler
+		int16_t service();                             // Process all ports, returns the samples dispatched
+		uint8_t get_connected();                       // Number of ports in data mode
+		bool all_connected();                          // True when every used port is in data mode
+	private:
+		void heartbeat();                              // Send the heartbeat on every port
+		static void heartbeat_handler(void* context);
+		EV3UARTSensor sensor[MAX_SENSORS];
+		bool used[MAX_SENSORS];
+#ifndef EV3UART_HOST
+		EV3UARTMbedTransport mbed_transport[MAX_SENSORS];
+#endif
+		EV3UARTTimer *timer;
+		bool heart_attached;                           // Heartbeats are sent from the timer interrupt
+		uint32_t last_beat;                            // Time of the last polled heartbeat
+		EV3UARTSampleHandler handler;
+		void* handler_context;
+};
+
+#endif
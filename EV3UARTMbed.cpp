@@ -0,0 +1,117 @@
+// EV3UARTMbed.cpp
+//
+// mbed implementation of the EV3 UART transport and timer.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UART_HOST
+
+#include "EV3UARTMbed.h"
+#include "SysTimer.h"
+
+EV3UARTMbedTransport::EV3UARTMbedTransport() {
+  serial = NULL;
+  rx_handler = NULL;
+  rx_context = NULL;
+  tx_handler = NULL;
+  tx_context = NULL;
+}
+
+EV3UARTMbedTransport::EV3UARTMbedTransport(RawSerial &serial) {
+  this->serial = &serial;
+  rx_handler = NULL;
+  rx_context = NULL;
+  tx_handler = NULL;
+  tx_context = NULL;
+}
+
+void EV3UARTMbedTransport::set_serial(RawSerial &serial) {
+  this->serial = &serial;
+}
+
+void EV3UARTMbedTransport::baud(uint32_t rate) {
+  serial->baud(rate);
+}
+
+bool EV3UARTMbedTransport::readable() {
+  return serial->readable();
+}
+
+uint8_t EV3UARTMbedTransport::getc() {
+  return (uint8_t) serial->getc();
+}
+
+bool EV3UARTMbedTransport::writeable() {
+  return serial->writeable();
+}
+
+void EV3UARTMbedTransport::putc(uint8_t b) {
+  serial->putc(b);
+}
+
+/**
+ * Attach the handler to the RX interrupt of the serial port
+**/
+bool EV3UARTMbedTransport::attach_rx(EV3UARTHandler handler, void* context) {
+  rx_handler = handler;
+  rx_context = context;
+  serial->attach(callback(this,&EV3UARTMbedTransport::rx_irq),SerialBase::RxIrq);
+  return true;
+}
+
+void EV3UARTMbedTransport::rx_irq() {
+  if (rx_handler) rx_handler(rx_context);
+}
+
+/**
+ * Set the handler for the TX interrupt. The interrupt stays off until
+ * enable_tx(true), as it fires for as long as the transmitter is empty
+**/
+bool EV3UARTMbedTransport::attach_tx(EV3UARTHandler handler, void* context) {
+  tx_handler = handler;
+  tx_context = context;
+  return true;
+}
+
+void EV3UARTMbedTransport::enable_tx(bool enable) {
+  if (enable) serial->attach(callback(this,&EV3UARTMbedTransport::tx_irq),SerialBase::TxIrq);
+  else serial->attach(Callback<void()>(),SerialBase::TxIrq);
+}
+
+void EV3UARTMbedTransport::tx_irq() {
+  if (tx_handler) tx_handler(tx_context);
+}
+
+EV3UARTMbedTimer::EV3UARTMbedTimer() {
+  tick_handler = NULL;
+  tick_context = NULL;
+  timer.start();
+}
+
+uint32_t EV3UARTMbedTimer::read_us() {
+  return (uint32_t) timer.read_us();
+}
+
+void EV3UARTMbedTimer::delay_ms(uint32_t ms) {
+  ::delay_ms(ms);
+}
+
+/**
+ * Call the handler periodically from the Ticker interrupt
+**/
+bool EV3UARTMbedTimer::attach_us(EV3UARTHandler handler, void* context, uint32_t period_us) {
+  tick_handler = handler;
+  tick_context = context;
+  ticker.attach_us(callback(this,&EV3UARTMbedTimer::tick),period_us);
+  return true;
+}
+
+void EV3UARTMbedTimer::detach() {
+  ticker.detach();
+}
+
+void EV3UARTMbedTimer::tick() {
+  if (tick_handler) tick_handler(tick_context);
+}
+
+#endif
@@ -0,0 +1,61 @@
+// EV3UARTMbed.h
+//
+// mbed implementation of the EV3 UART transport and timer.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTMBED_H
+#define EV3UARTMBED_H
+
+#ifndef EV3UART_HOST
+
+#include "EV3UARTTransport.h"
+
+/**
+* Transport over an mbed RawSerial
+**/
+class EV3UARTMbedTransport : public EV3UARTTransport {
+	public:
+		EV3UARTMbedTransport();
+		EV3UARTMbedTransport(RawSerial &serial);
+		void set_serial(RawSerial &serial);            // Use another serial port
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+		bool attach_rx(EV3UARTHandler handler, void* context);
+		bool attach_tx(EV3UARTHandler handler, void* context);
+		void enable_tx(bool enable);
+	private:
+		void rx_irq();
+		void tx_irq();
+		RawSerial *serial;
+		EV3UARTHandler rx_handler;
+		void* rx_context;
+		EV3UARTHandler tx_handler;
+		void* tx_context;
+};
+
+/**
+* Timer using an mbed Timer and Ticker. Delays use delay_ms from SysTimer
+* because wait_ms conflicts with the Ticker
+**/
+class EV3UARTMbedTimer : public EV3UARTTimer {
+	public:
+		EV3UARTMbedTimer();
+		uint32_t read_us();
+		void delay_ms(uint32_t ms);
+		bool attach_us(EV3UARTHandler handler, void* context, uint32_t period_us);
+		void detach();
+	private:
+		void tick();
+		Timer timer;
+		Ticker ticker;
+		EV3UARTHandler tick_handler;
+		void* tick_context;
+};
+
+#endif
+
+#endif
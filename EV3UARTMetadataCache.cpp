@@ -0,0 +1,161 @@
+// EV3UARTMetadataCache.cpp
+//
+// Cache of the metadata sent by sensors during the handshake.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTMetadataCache.h"
+
+// Start of a saved cache
+#define CACHE_MAGIC0 'E'
+#define CACHE_MAGIC1 'V'
+#define CACHE_MAGIC2 '3'
+#define CACHE_MAGIC3 'C'
+#define CACHE_VERSION 2
+
+// Bits of the flags byte of a saved entry
+#define CACHE_FLAG_NO_EARLY_ACK 0x01
+
+EV3UARTMetadataCache::EV3UARTMetadataCache() {
+  clear();
+}
+
+const EV3UARTMetadata* EV3UARTMetadataCache::find(uint8_t type) {
+  for(int i=0;i<CACHE_ENTRIES;i++)
+    if (used[i] && entry[i].type == type) return &entry[i];
+  return NULL;
+}
+
+/**
+ * Add the metadata, replacing the entry of the same type or the oldest one.
+ * A type that rejected the early ACK keeps rejecting it
+**/
+void EV3UARTMetadataCache::store(const EV3UARTMetadata &metadata) {
+  int slot = -1;
+  for(int i=0;i<CACHE_ENTRIES;i++)
+    if (used[i] && entry[i].type == metadata.type) slot = i;
+  bool no_early_ack = metadata.no_early_ack || (slot >= 0 && entry[slot].no_early_ack);
+  for(int i=0;i<CACHE_ENTRIES && slot < 0;i++)
+    if (!used[i]) slot = i;
+  if (slot < 0) {
+    slot = next;
+    next = (next + 1) % CACHE_ENTRIES;
+  }
+  entry[slot] = metadata;
+  entry[slot].no_early_ack = no_early_ack;
+  used[slot] = true;
+}
+
+void EV3UARTMetadataCache::reject_early_ack(uint8_t type) {
+  for(int i=0;i<CACHE_ENTRIES;i++)
+    if (used[i] && entry[i].type == type) entry[i].no_early_ack = true;
+}
+
+void EV3UARTMetadataCache::remove(uint8_t type) {
+  for(int i=0;i<CACHE_ENTRIES;i++)
+    if (used[i] && entry[i].type == type) used[i] = false;
+}
+
+void EV3UARTMetadataCache::clear() {
+  for(int i=0;i<CACHE_ENTRIES;i++) used[i] = false;
+  next = 0;
+}
+
+/**
+ * Serialise the cache. Only the values received from the sensors are saved,
+ * decoders and scales are recalculated by load(). Layout: magic, version,
+ * number of entries, the entries and an XOR checksum
+**/
+size_t EV3UARTMetadataCache::save(uint8_t* buf, size_t size) {
+  if (size < SAVE_SIZE) return 0;
+  size_t n = 0;
+  buf[n++] = CACHE_MAGIC0;
+  buf[n++] = CACHE_MAGIC1;
+  buf[n++] = CACHE_MAGIC2;
+  buf[n++] = CACHE_MAGIC3;
+  buf[n++] = CACHE_VERSION;
+  size_t count = n++;
+  buf[count] = 0;
+  for(int i=0;i<CACHE_ENTRIES;i++) {
+    if (!used[i]) continue;
+    const EV3UARTMetadata &e = entry[i];
+    buf[count]++;
+    buf[n++] = e.type;
+    buf[n++] = e.modes;
+    buf[n++] = e.views;
+    buf[n++] = e.no_early_ack ? CACHE_FLAG_NO_EARLY_ACK : 0;
+    for(int j=0;j<4;j++) buf[n++] = (uint8_t) (e.speed >> (8*j));
+    for(int m=0;m<MAX_MODES;m++) {
+      const EV3UARTMode &md = e.mode[m];
+      memcpy(buf+n, md.name, MODE_NAME_SIZE);
+      n += MODE_NAME_SIZE;
+      memcpy(buf+n, md.symbol, MODE_SYMBOL_SIZE);
+      n += MODE_SYMBOL_SIZE;
+      buf[n++] = md.sets;
+      buf[n++] = md.data_type;
+      buf[n++] = md.figures;
+      buf[n++] = md.decimals;
+      float ranges[6] = {md.raw_low, md.raw_high, md.pct_low, md.pct_high, md.si_low, md.si_high};
+      memcpy(buf+n, ranges, sizeof(ranges));
+      n += sizeof(ranges);
+    }
+  }
+  uint8_t checksum = 0xff;
+  for(size_t i=0;i<n;i++) checksum ^= buf[i];
+  buf[n++] = checksum;
+  return n;
+}
+
+/**
+ * Restore a cache written by save(). The cache is unchanged if buf is invalid
+**/
+bool EV3UARTMetadataCache::load(const uint8_t* buf, size_t len) {
+  if (len < SAVE_HEADER_SIZE + 1 || buf[0] != CACHE_MAGIC0 || buf[1] != CACHE_MAGIC1 ||
+      buf[2] != CACHE_MAGIC2 || buf[3] != CACHE_MAGIC3 || buf[4] != CACHE_VERSION) return false;
+  uint8_t count = buf[5];
+  size_t total = SAVE_HEADER_SIZE + count * ENTRY_SIZE + 1;
+  if (count > CACHE_ENTRIES || len < total) return false;
+  uint8_t checksum = 0xff;
+  for(size_t i=0;i<total-1;i++) checksum ^= buf[i];
+  if (checksum != buf[total-1]) return false;
+
+  clear();
+  size_t n = SAVE_HEADER_SIZE;
+  for(int i=0;i<count;i++) {
+    EV3UARTMetadata &e = entry[i];
+    e.type = buf[n++];
+    e.modes = buf[n++];
+    e.views = buf[n++];
+    e.no_early_ack = (buf[n++] & CACHE_FLAG_NO_EARLY_ACK) != 0;
+    e.speed = 0;
+    for(int j=0;j<4;j++) e.speed |= (uint32_t) buf[n++] << (8*j);
+    for(int m=0;m<MAX_MODES;m++) {
+      EV3UARTMode &md = e.mode[m];
+      md = EV3UARTMode();
+      memcpy(md.name, buf+n, MODE_NAME_SIZE);
+      md.name[MODE_NAME_SIZE-1] = 0;
+      n += MODE_NAME_SIZE;
+      memcpy(md.symbol, buf+n, MODE_SYMBOL_SIZE);
+      md.symbol[MODE_SYMBOL_SIZE-1] = 0;
+      n += MODE_SYMBOL_SIZE;
+      uint8_t sets = buf[n++];
+      uint8_t data_type = buf[n++];
+      uint8_t figures = buf[n++];
+      uint8_t decimals = buf[n++];
+      float ranges[6];
+      memcpy(ranges, buf+n, sizeof(ranges));
+      n += sizeof(ranges);
+      md.raw_low = ranges[0];
+      md.raw_high = ranges[1];
+      md.pct_low = ranges[2];
+      md.pct_high = ranges[3];
+      md.si_low = ranges[4];
+      md.si_high = ranges[5];
+      md.update_scale();
+      // Modes the sensor does not have keep an invalid format
+      if (m < e.modes) md.set_format(sets, data_type, figures, decimals);
+    }
+    used[i] = true;
+  }
+  return true;
+}
@@ -0,0 +1,69 @@
+// EV3UARTMetadataCache.h
+//
+// Cache of the metadata sent by sensors during the handshake, so a sensor of
+// a known type can be put back in data mode without waiting for its INFO
+// messages again.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTMETADATACACHE_H
+#define EV3UARTMETADATACACHE_H
+
+#include "EV3UARTSensor.h"
+
+// Number of sensor types kept in a cache
+#ifndef CACHE_ENTRIES
+#define CACHE_ENTRIES 2
+#endif
+
+/**
+* Everything a sensor reports before its ACK
+**/
+struct EV3UARTMetadata {
+	uint8_t type;                         // The LEGO type code
+	uint8_t modes;                        // The number of modes
+	uint8_t views;                        // The number of views
+	uint32_t speed;                       // The bit rate of data mode
+	bool no_early_ack;                    // The sensor ignored an early ACK, always do the full handshake
+	EV3UARTMode mode[MAX_MODES];          // The mode table
+};
+
+/**
+* Metadata of up to CACHE_ENTRIES sensor types, kept in RAM. It can be saved
+* to a buffer, e.g. to store it in flash, and loaded back after a restart.
+*
+* @code
+* EV3UARTMetadataCache cache;
+* sensor.set_cache(&cache);
+* ...
+* uint8_t buf[EV3UARTMetadataCache::SAVE_SIZE];
+* size_t n = cache.save(buf, sizeof(buf));
+* @endcode
+**/
+class EV3UARTMetadataCache {
+	public:
+		// Layout of save(): magic, version and count, the entries and a checksum
+		static const size_t SAVE_HEADER_SIZE = 6;
+		// type, modes, views, flags and speed
+		static const size_t ENTRY_HEADER_SIZE = 4 + sizeof(uint32_t);
+		// name, symbol, sets, data type, figures, decimals and the three ranges
+		static const size_t MODE_RECORD_SIZE = MODE_NAME_SIZE + MODE_SYMBOL_SIZE + 4 + 6 * sizeof(float);
+		static const size_t ENTRY_SIZE = ENTRY_HEADER_SIZE + MAX_MODES * MODE_RECORD_SIZE;
+		// Bytes needed by save() for a full cache
+		static const size_t SAVE_SIZE = SAVE_HEADER_SIZE + CACHE_ENTRIES * ENTRY_SIZE + 1;
+
+		EV3UARTMetadataCache();
+		const EV3UARTMetadata* find(uint8_t type);    // The entry for a type, NULL if none
+		void store(const EV3UARTMetadata &metadata);  // Add or replace the entry for its type
+		void remove(uint8_t type);                    // Forget a type
+		void reject_early_ack(uint8_t type);          // Stop acknowledging a type early, it does not accept it
+		void clear();                                 // Forget every type
+		size_t save(uint8_t* buf, size_t size);       // Serialise, returns bytes written or 0 if too small
+		bool load(const uint8_t* buf, size_t len);    // Restore from save(), false if invalid
+	private:
+		EV3UARTMetadata entry[CACHE_ENTRIES];
+		bool used[CACHE_ENTRIES];
+		uint8_t next;                                 // Entry replaced when the cache is full
+};
+
+#endif
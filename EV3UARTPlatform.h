@@ -0,0 +1,30 @@
+// EV3UARTPlatform.h
+//
+// Platform selection for the EV3 UART sensor library.
+// Define EV3UART_HOST to build without mbed (Linux hosts, simulators, CI).
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTPLATFORM_H
+#define EV3UARTPLATFORM_H
+
+#ifdef EV3UART_HOST
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+// Full memory barrier between the interrupt (or thread) and the application
+#define EV3UART_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+// Host transports have no interrupts: nothing to mask
+#define EV3UART_CRITICAL_ENTER() ((void) 0)
+#define EV3UART_CRITICAL_EXIT() ((void) 0)
+#else
+#include <mbed.h>
+#include <string.h>
+#define EV3UART_BARRIER() __DMB()
+// Short sections shared by interrupt handlers and the application
+#define EV3UART_CRITICAL_ENTER() core_util_critical_section_enter()
+#define EV3UART_CRITICAL_EXIT() core_util_critical_section_exit()
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+// EV3UARTReader.cpp
+//
+// Runs a sensor in a thread of its own.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTReader.h"
+
+#if defined(EV3UART_HOST) || defined(MBED_CONF_RTOS_PRESENT)
+
+#ifdef EV3UART_HOST
+#include <chrono>
+
+EV3UARTReader::EV3UARTReader() {
+  head = 0;
+  tail = 0;
+  pending_mode = -1;
+#else
+EV3UARTReader::EV3UARTReader()
+  : thread(osPriorityNormal, READER_STACK_SIZE), events(READER_EVENTS * EVENTS_EVENT_SIZE) {
+  rx_handler = NULL;
+  rx_context = NULL;
+  rx_posted = false;
+  wake_posted = false;
+  thread_started = false;
+  beat_id = 0;
+#endif
+  sensor = NULL;
+  transport = NULL;
+  timer = NULL;
+  running = false;
+  dropped = 0;
+}
+
+EV3UARTReader::~EV3UARTReader() {
+  stop();
+}
+
+void EV3UARTReader::frame_handler(void* context, const EV3UARTFrame &frame) {
+  ((EV3UARTReader*) context)->put(frame);
+}
+
+uint32_t EV3UARTReader::get_dropped() {
+  return dropped;
+}
+
+void EV3UARTReader::baud(uint32_t rate) {
+  transport->baud(rate);
+}
+
+bool EV3UARTReader::readable() {
+  return transport->readable();
+}
+
+uint8_t EV3UARTReader::getc() {
+  return transport->getc();
+}
+
+bool EV3UARTReader::writeable() {
+  return transport->writeable();
+}
+
+void EV3UARTReader::putc(uint8_t b) {
+  transport->putc(b);
+}
+
+#ifdef EV3UART_HOST
+
+/**
+ * Begin the sensor on transport and start the thread. The sensor is
+ * polled from the thread, which sends the heartbeats itself
+**/
+bool EV3UARTReader::start(EV3UARTSensor &sensor, EV3UARTTransport &transport, EV3UARTTimer &timer) {
+  if (running) return false;
+  this->sensor = &sensor;
+  this->transport = &transport;
+  this->timer = &timer;
+  head = tail = 0;
+  pending_mode = -1;
+  sensor.set_external_heartbeat(true);
+  sensor.on_frame(&EV3UARTReader::frame_handler, this);
+  sensor.begin(*this, timer, false);
+  running = true;
+  thread = std::thread(&EV3UARTReader::run, this);
+  return true;
+}
+
+/**
+ * Stop the thread. It notices within a heartbeat period
+**/
+void EV3UARTReader::stop() {
+  if (!running) return;
+  running = false;
+  thread.join();
+  sensor->on_frame(NULL, NULL);
+}
+
+/**
+ * Sleep in the transport until bytes arrive or the next heartbeat, or the
+ * speed change after the ACK, is due
+**/
+void EV3UARTReader::run() {
+  EV3UARTProgress progress;
+  uint32_t next_beat = timer->read_us() + HEART_BEAT_PERIOD_US;
+  while (running) {
+    int16_t mode;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      mode = pending_mode;
+      pending_mode = -1;
+    }
+    if (mode >= 0) sensor->request_mode((uint8_t) mode);
+    int32_t wait = (int32_t) (next_beat - timer->read_us());
+    if (wait < 0) wait = 0;
+    sensor->get_progress(progress);
+    if (progress.step == HANDSHAKE_ACK && wait > ACK_DELAY_US) wait = ACK_DELAY_US;
+    transport->wait_readable((uint32_t) wait);
+    sensor->check_for_data();
+    uint32_t now = timer->read_us();
+    if ((int32_t) (now - next_beat) >= 0) {
+      sensor->heartbeat();
+      next_beat += HEART_BEAT_PERIOD_US;
+      // After a long stall, start counting again from now
+      if ((int32_t) (now - next_beat) >= 0) next_beat = now + HEART_BEAT_PERIOD_US;
+    }
+  }
+}
+
+void EV3UARTReader::put(const EV3UARTFrame &frame) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (head - tail >= READER_QUEUE) {
+      dropped++;
+      return;
+    }
+    queue[head++ % READER_QUEUE] = frame;
+  }
+  ready.notify_one();
+}
+
+bool EV3UARTReader::get(EV3UARTFrame &frame, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> guard(lock);
+  if (!ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this] { return head != tail; }))
+    return false;
+  frame = queue[tail++ % READER_QUEUE];
+  return true;
+}
+
+/**
+ * The thread requests the mode the next time it wakes up
+**/
+void EV3UARTReader::request_mode(uint8_t mode) {
+  std::lock_guard<std::mutex> guard(lock);
+  pending_mode = mode;
+}
+
+/**
+ * No RX interrupt: the thread blocks in wait_readable() instead
+**/
+bool EV3UARTReader::attach_rx(EV3UARTHandler handler, void* context) {
+  return false;
+}
+
+#else
+
+/**
+ * Begin the sensor on transport with its RX interrupt and start serving
+ * it from the thread. The thread is created by the first start() and
+ * sleeps in its EventQueue after stop()
+**/
+bool EV3UARTReader::start(EV3UARTSensor &sensor, EV3UARTTransport &transport, EV3UARTTimer &timer) {
+  if (running) return false;
+  this->sensor = &sensor;
+  this->transport = &transport;
+  this->timer = &timer;
+  sensor.set_external_heartbeat(true);
+  sensor.on_frame(&EV3UARTReader::frame_handler, this);
+  running = true;
+  sensor.begin(*this, timer, true);
+  if (!thread_started) {
+    thread.start(callback(&events, &events::EventQueue::dispatch_forever));
+    thread_started = true;
+  }
+  beat_id = events.call_every(HEART_BEAT_PERIOD_US / 1000, this, &EV3UARTReader::beat);
+  events.call(this, &EV3UARTReader::service);
+  return true;
+}
+
+/**
+ * Stop serving the sensor. Bytes received are still buffered by its RX
+ * interrupt, so it can be polled with check_for_data() again
+**/
+void EV3UARTReader::stop() {
+  if (!running) return;
+  running = false;
+  events.cancel(beat_id);
+  events.call(this, &EV3UARTReader::finish);
+}
+
+void EV3UARTReader::finish() {
+  if (!running) sensor->on_frame(NULL, NULL);
+}
+
+/**
+ * RX interrupt: the sensor moves the bytes to its buffer, and one
+ * service() is queued for however many bytes arrive before it runs
+**/
+void EV3UARTReader::rx_irq(void* context) {
+  EV3UARTReader* r = (EV3UARTReader*) context;
+  if (r->rx_handler) r->rx_handler(r->rx_context);
+  if (r->running && !r->rx_posted) {
+    r->rx_posted = true;
+    if (r->events.call(r, &EV3UARTReader::service) == 0) r->rx_posted = false;
+  }
+}
+
+void EV3UARTReader::service() {
+  rx_posted = false;
+  if (!running) return;
+  sensor->check_for_data();
+  // The speed changes ACK_DELAY_US after the ACK, with no byte to wake us
+  EV3UARTProgress progress;
+  sensor->get_progress(progress);
+  if (progress.step == HANDSHAKE_ACK && !wake_posted) {
+    wake_posted = true;
+    events.call_in(ACK_DELAY_US / 1000 + 1, this, &EV3UARTReader::wake);
+  }
+}
+
+void EV3UARTReader::wake() {
+  wake_posted = false;
+  service();
+}
+
+void EV3UARTReader::beat() {
+  if (!running) return;
+  sensor->heartbeat();
+  sensor->check_for_data();
+}
+
+void EV3UARTReader::select(uint8_t mode) {
+  if (running) sensor->request_mode(mode);
+}
+
+/**
+ * Frames are handed over in the thread, never from an interrupt
+**/
+void EV3UARTReader::put(const EV3UARTFrame &frame) {
+  EV3UARTFrame* f = mail.alloc();
+  if (f == NULL) {
+    dropped++;
+    return;
+  }
+  *f = frame;
+  mail.put(f);
+}
+
+bool EV3UARTReader::get(EV3UARTFrame &frame, uint32_t timeout_ms) {
+  osEvent e = mail.get(timeout_ms);
+  if (e.status != osEventMail) return false;
+  EV3UARTFrame* f = (EV3UARTFrame*) e.value.p;
+  frame = *f;
+  mail.free(f);
+  return true;
+}
+
+void EV3UARTReader::request_mode(uint8_t mode) {
+  events.call(this, &EV3UARTReader::select, mode);
+}
+
+/**
+ * Put the reader between the RX interrupt and the sensor's handler
+**/
+bool EV3UARTReader::attach_rx(EV3UARTHandler handler, void* context) {
+  rx_handler = handler;
+  rx_context = context;
+  return transport->attach_rx(&EV3UARTReader::rx_irq, this);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+// EV3UARTReader.h
+//
+// Runs a sensor in a thread of its own: the thread sleeps until bytes
+// arrive or a heartbeat is due, and hands every frame to the application
+// through a queue. Built on mbed OS (Thread, EventQueue and Mail) and, with
+// EV3UART_HOST, on std::thread.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTREADER_H
+#define EV3UARTREADER_H
+
+#include "EV3UARTSensor.h"
+
+#if defined(EV3UART_HOST) || defined(MBED_CONF_RTOS_PRESENT)
+
+#ifdef EV3UART_HOST
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// Frames waiting for the application. Further frames are dropped and counted
+#ifndef READER_QUEUE
+#define READER_QUEUE 16
+#endif
+
+// Stack of the reader thread in mbed OS
+#ifndef READER_STACK_SIZE
+#define READER_STACK_SIZE 2048
+#endif
+
+// Events that can be pending in the reader's EventQueue in mbed OS
+#ifndef READER_EVENTS
+#define READER_EVENTS 8
+#endif
+
+/**
+* Reader thread of one sensor. It is also the transport the sensor is
+* given, wrapping the real one: received bytes wake the thread, and bytes
+* are only ever written from the thread, never from an interrupt, as the
+* TX interrupt and the heartbeat Ticker are not used. Once started, the
+* sensor belongs to the thread; change its mode with request_mode().
+*
+* On Linux the thread blocks in EV3UARTTransport::wait_readable(), which
+* EV3UARTLinuxTransport implements with poll() and EV3UARTSimulator by
+* moving its virtual clock.
+*
+* @code
+* RawSerial serial(PTC17,PTC16);
+* EV3UARTMbedTransport transport(serial);
+* EV3UARTMbedTimer timer;
+* EV3UARTSensor sensor;
+* EV3UARTReader reader;
+*
+* int main(){
+*   reader.start(sensor, transport, timer);
+*   reader.request_mode(RGBRaw);
+*   EV3UARTFrame frame;
+*   while(true) {
+*     if (reader.get(frame, 1000)) printf("mode %d seq %lu\n", frame.mode, frame.seq);
+*   }
+* }
+* @endcode
+**/
+class EV3UARTReader : public EV3UARTTransport {
+	public:
+		EV3UARTReader();
+		~EV3UARTReader();
+		bool start(EV3UARTSensor &sensor, EV3UARTTransport &transport, EV3UARTTimer &timer); // Begin the sensor in the thread
+		void stop();                                   // Stop the thread. The sensor can then be polled again
+		bool get(EV3UARTFrame &frame, uint32_t timeout_ms); // Wait for the next frame. False on timeout
+		void request_mode(uint8_t mode);               // Ask the thread to switch the sensor's mode
+		uint32_t get_dropped();                        // Frames lost because the queue was full
+
+		// EV3UARTTransport
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+		bool attach_rx(EV3UARTHandler handler, void* context);
+
+	private:
+		static void frame_handler(void* context, const EV3UARTFrame &frame);
+		void put(const EV3UARTFrame &frame);           // Queue a frame for get()
+		EV3UARTSensor *sensor;
+		EV3UARTTransport *transport;                   // The transport wrapped
+		EV3UARTTimer *timer;
+#ifdef EV3UART_HOST
+		std::atomic<bool> running;                     // Read by the thread, set by the application
+#else
+		volatile bool running;
+#endif
+		volatile uint32_t dropped;
+#ifdef EV3UART_HOST
+		void run();                                    // Body of the thread
+		std::thread thread;
+		std::mutex lock;                               // Guards the queue and pending_mode
+		std::condition_variable ready;
+		EV3UARTFrame queue[READER_QUEUE];
+		uint32_t head, tail;
+		int16_t pending_mode;                          // Mode to request, -1 for none
+#else
+		static void rx_irq(void* context);
+		void service();                                // Process received bytes and anything due
+		void wake();                                   // service() when the speed change is due
+		void beat();                                   // Send a heartbeat
+		void select(uint8_t mode);
+		void finish();                                 // Stop taking frames, after stop()
+		EV3UARTHandler rx_handler;                     // The sensor's RX handler
+		void* rx_context;
+		volatile bool rx_posted;                       // A service() is queued for received bytes
+		bool wake_posted;
+		bool thread_started;
+		rtos::Thread thread;
+		events::EventQueue events;
+		rtos::Mail<EV3UARTFrame, READER_QUEUE> mail;
+		int beat_id;                                   // The periodic heartbeat event
+#endif
+};
+
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+// EV3UARTRingBuffer.h
+//
+// Fixed-size single-producer/single-consumer ring buffer used to pass
+// bytes and samples between interrupt context and the application.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTRINGBUFFER_H
+#define EV3UARTRINGBUFFER_H
+
+#include "EV3UARTPlatform.h"
+
+/**
+* Lock-free ring buffer for exactly one producer and one consumer.
+* The producer may run in an interrupt handler. N must be a power of two.
+**/
+template <typename T, uint16_t N>
+class EV3UARTRingBuffer {
+	public:
+		EV3UARTRingBuffer() : head(0), tail(0), overruns(0) {}
+
+		// Add an item (producer side). Returns false and counts an overrun if full
+		bool push(const T &item) {
+			uint16_t h = head;
+			if ((uint16_t)(h - tail) >= N) {
+				overruns++;
+				return false;
+			}
+			buf[h & (N - 1)] = item;
+			EV3UART_BARRIER();                // Item must be visible before the index moves
+			head = h + 1;
+			return true;
+		}
+
+		// Remove an item (consumer side). Returns false if empty
+		bool pop(T &item) {
+			uint16_t t = tail;
+			if (t == head) return false;
+			item = buf[t & (N - 1)];
+			EV3UART_BARRIER();                // Finish reading before the slot is released
+			tail = t + 1;
+			return true;
+		}
+
+		// Look at the next item without removing it (consumer side)
+		bool peek(T &item) const {
+			if (tail == head) return false;
+			item = buf[tail & (N - 1)];
+			return true;
+		}
+
+		uint16_t size() const { return (uint16_t)(head - tail); }
+		bool empty() const { return head == tail; }
+		uint16_t capacity() const { return N; }
+		uint32_t get_overruns() const { return overruns; }
+
+		// Discard everything (consumer side)
+		void clear() { tail = head; }
+
+	private:
+		T buf[N];
+		volatile uint16_t head;               // Written only by the producer
+		volatile uint16_t tail;               // Written only by the consumer
+		volatile uint32_t overruns;           // Items dropped because the buffer was full
+};
+
+#endif
@@ -0,0 +1,168 @@
+// EV3UARTScheduler.cpp
+//
+// Reads several modes of one sensor by cycling through them.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTScheduler.h"
+
+EV3UARTScheduler::EV3UARTScheduler() {
+  sensor = NULL;
+  count = 0;
+  current = 0;
+  received = 0;
+  switching = false;
+  running = false;
+  started = false;
+  start_us = 0;
+  last_us = 0;
+}
+
+/**
+ * Add a mode to the end of the cycle: it stays selected for dwell frames
+ * after the first skip ones, which are discarded. The Color sensor needs a
+ * frame or two to settle after changing the light it emits. A mode can be
+ * added more than once to read it more often
+**/
+bool EV3UARTScheduler::add(uint8_t mode, uint8_t dwell, uint8_t skip) {
+  if (count >= SCHEDULE_SLOTS || running) return false;
+  Slot &s = slot[count++];
+  s.mode = mode;
+  s.dwell = dwell ? dwell : 1;
+  s.skip = skip;
+  return true;
+}
+
+void EV3UARTScheduler::clear() {
+  if (!running) count = 0;
+}
+
+/**
+ * Empty the streams, zero the counters and select the first mode. If the
+ * sensor is not in data mode yet, the mode is selected when its first
+ * frame arrives
+**/
+void EV3UARTScheduler::start(EV3UARTSensor &sensor) {
+  if (count == 0) return;
+  this->sensor = &sensor;
+  for(uint8_t i=0;i<count;i++) {
+    slot[i].frames = 0;
+    slot[i].skipped = 0;
+    slot[i].dropped = 0;
+    slot[i].switches = 0;
+    slot[i].switch_total = 0;
+    slot[i].stream.clear();
+  }
+  current = 0;
+  started = false;
+  sensor.on_frame(NULL, NULL);
+  running = true;
+  select();
+  sensor.on_frame(&EV3UARTScheduler::frame_handler, this);
+}
+
+void EV3UARTScheduler::stop() {
+  if (sensor) sensor->on_frame(NULL, NULL);
+  running = false;
+}
+
+uint8_t EV3UARTScheduler::get_count() {
+  return count;
+}
+
+void EV3UARTScheduler::frame_handler(void* context, const EV3UARTFrame &frame) {
+  ((EV3UARTScheduler*) context)->on_frame(frame);
+}
+
+EV3UARTScheduler::Slot* EV3UARTScheduler::find(uint8_t mode) {
+  for(uint8_t i=0;i<count;i++)
+    if (slot[i].mode == mode) return &slot[i];
+  return NULL;
+}
+
+void EV3UARTScheduler::select() {
+  received = 0;
+  switching = true;
+  sensor->request_mode(slot[current].mode);
+}
+
+/**
+ * Called from the parser with each frame
+**/
+void EV3UARTScheduler::on_frame(const EV3UARTFrame &frame) {
+  if (!running) return;
+  if (!started) {
+    start_us = frame.timestamp_us;
+    started = true;
+  }
+  last_us = frame.timestamp_us;
+  Slot &s = slot[current];
+  if (frame.mode == s.mode && switching) {
+    // The switch is confirmed by this frame, its latency is known now
+    switching = false;
+    s.switches++;
+    s.switch_total += sensor->get_switch_latency();
+  } else if (frame.mode != s.mode && sensor->get_mode_switch() != SWITCH_PENDING) {
+    // The sensor reconnected, or another mode was requested behind our back
+    select();
+  }
+
+  // Frames of the current mode count for the current slot, even if the
+  // mode is listed earlier too. A mode listed twice has one stream, in its
+  // first slot
+  Slot* to = (frame.mode == s.mode) ? &s : find(frame.mode);
+  if (to == NULL) return;
+  if (to == &s && received < s.skip) {
+    s.skipped++;
+  } else if (find(frame.mode)->stream.push(frame)) {
+    to->frames++;
+  } else {
+    to->dropped++;
+  }
+  if (to != &s || switching) return;
+
+  // Send the next CMD_SELECT right after the last frame needed
+  if (++received >= s.skip + s.dwell && count > 1) {
+    current = (current + 1) % count;
+    select();
+  }
+}
+
+/**
+ * Take up to max frames of a mode, oldest first. Returns the number taken
+**/
+int16_t EV3UARTScheduler::fetch_frames(uint8_t mode, EV3UARTFrame* out, int16_t max) {
+  Slot* s = find(mode);
+  int16_t n = 0;
+  if (s == NULL) return 0;
+  while(n < max && s->stream.pop(out[n])) n++;
+  return n;
+}
+
+int16_t EV3UARTScheduler::fetch_samples(uint8_t mode, EV3UARTSample* out, int16_t max) {
+  Slot* s = find(mode);
+  EV3UARTFrame frame;
+  int16_t n = 0;
+  if (s == NULL) return 0;
+  while(n < max && s->stream.pop(frame)) frame.to_sample(out[n++]);
+  return n;
+}
+
+/**
+ * Copy the counters of a mode of the cycle. The rate is over the time from
+ * the first to the latest frame since start(), for comparing with the frame
+ * rate of the mode read alone
+**/
+void EV3UARTScheduler::get_stats(uint8_t index, EV3UARTScheduleStats &out) {
+  memset(&out, 0, sizeof(out));
+  if (index >= count) return;
+  const Slot &s = slot[index];
+  out.mode = s.mode;
+  out.frames = s.frames;
+  out.skipped = s.skipped;
+  out.dropped = s.dropped;
+  out.switches = s.switches;
+  out.switch_us = s.switches ? s.switch_total / s.switches : 0;
+  uint32_t elapsed = last_us - start_us;
+  out.rate = elapsed ? s.frames * 1000000.0f / elapsed : 0;
+}
@@ -0,0 +1,96 @@
+// EV3UARTScheduler.h
+//
+// Reads several modes of one sensor by cycling through them, switching as
+// soon as each mode has delivered its frames.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTSCHEDULER_H
+#define EV3UARTSCHEDULER_H
+
+#include "EV3UARTSensor.h"
+
+// Maximum number of modes in a cycle
+#ifndef SCHEDULE_SLOTS
+#define SCHEDULE_SLOTS 4
+#endif
+
+// Frames kept for each mode until fetched (power of two)
+#ifndef SCHEDULE_HISTORY
+#define SCHEDULE_HISTORY 8
+#endif
+
+/**
+* Counters of one mode of the cycle, see EV3UARTScheduler::get_stats()
+**/
+struct EV3UARTScheduleStats {
+	uint8_t mode;
+	uint32_t frames;                      // Frames put in the mode's stream while this slot was selected
+	uint32_t skipped;                     // Frames discarded after switching to the mode
+	uint32_t dropped;                     // Frames lost because the stream was full
+	uint32_t switches;                    // Switches to the mode confirmed by the sensor
+	uint32_t switch_us;                   // Mean time from CMD_SELECT to the first frame
+	float rate;                           // Frames per second in the stream since start()
+};
+
+/**
+* Round robin over a list of modes. Each mode stays selected until dwell
+* frames of it arrive, after the first skip ones which are dropped; the
+* CMD_SELECT of the next mode is sent from the parser on the last one, so
+* no frame period is lost waiting for the application. Every frame goes to
+* the stream of its own mode, including frames of the previous mode still
+* arriving after a switch.
+*
+* @code
+* EV3UARTScheduler scheduler;
+* scheduler.add(ColReflect, 2);
+* scheduler.add(ColAmbient, 2);
+* scheduler.add(RGBRaw, 4);
+* scheduler.start(sensor);
+* while(true) {
+*   sensor.check_for_data();
+*   EV3UARTSample s;
+*   while(scheduler.fetch_samples(RGBRaw, &s, 1)) printf("%.0f %.0f %.0f\n", s.value[0], s.value[1], s.value[2]);
+* }
+* @endcode
+**/
+class EV3UARTScheduler {
+	public:
+		EV3UARTScheduler();
+		bool add(uint8_t mode, uint8_t dwell, uint8_t skip = 0); // Add a mode to the cycle. False if full
+		void clear();                                  // Empty the cycle. Only while stopped
+		void start(EV3UARTSensor &sensor);             // Take the sensor's frames and select the first mode
+		void stop();                                   // Stop switching, leave the sensor in its mode
+		int16_t fetch_frames(uint8_t mode, EV3UARTFrame* out, int16_t max);   // Frames of a mode since the last call
+		int16_t fetch_samples(uint8_t mode, EV3UARTSample* out, int16_t max); // Same, converted to float
+		uint8_t get_count();                           // Number of modes in the cycle
+		void get_stats(uint8_t index, EV3UARTScheduleStats &out); // Counters of the index-th mode of the cycle
+	private:
+		struct Slot {
+			uint8_t mode;
+			uint8_t dwell;                             // Frames kept before switching
+			uint8_t skip;                              // Frames dropped after switching
+			uint32_t frames;
+			uint32_t skipped;
+			uint32_t dropped;
+			uint32_t switches;
+			uint32_t switch_total;                     // Sum of the switch latencies
+			EV3UARTRingBuffer<EV3UARTFrame, SCHEDULE_HISTORY> stream;
+		};
+		static void frame_handler(void* context, const EV3UARTFrame &frame);
+		void on_frame(const EV3UARTFrame &frame);     // Route a frame and switch when the dwell is reached
+		void select();                                 // Request the mode of the current slot
+		Slot* find(uint8_t mode);                      // The first slot of a mode, NULL if none
+		EV3UARTSensor *sensor;
+		Slot slot[SCHEDULE_SLOTS];
+		uint8_t count;
+		uint8_t current;                               // Slot selected
+		uint8_t received;                              // Frames of it since it was selected
+		bool switching;                                // Waiting for the first frame of the current slot
+		bool running;
+		bool started;                                  // A frame arrived since start()
+		uint32_t start_us;                             // Time of that frame
+		uint32_t last_us;                              // Time of the latest frame
+};
+
+#endif
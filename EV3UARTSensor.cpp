@@ -7,19 +7,136 @@
 // Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
 
 #include "EV3UARTSensor.h"
-#include "SysTimer.h"
+#include "EV3UARTMetadataCache.h"
 
 
 /**
  * Create a mode object
 **/
 EV3UARTMode::EV3UARTMode() {
+  name[0] = 0;
+  symbol[0] = 0;
+  sets = 1;
+  data_type = 0;
+  figures = 0;
+  decimals = 0;
+  // Ranges assumed by the protocol until INFO messages give others
+  raw_low = 0;
+  raw_high = 1023;
+  si_low = 0;
+  si_high = 1023;
+  pct_low = 0;
+  pct_high = 100;
+  update_scale();
+  items = 0;
+  payload_size = 0;
+  decoder = NULL;
+}
+
+/**
+ * Precompute the linear maps from the raw range to the SI and percent ranges
+**/
+void EV3UARTMode::update_scale() {
+  float raw_span = raw_high - raw_low;
+  if (raw_span == 0) {
+    si_scale = pct_scale = 1;
+    si_offset = pct_offset = 0;
+    return;
+  }
+  si_scale = (si_high - si_low) / raw_span;
+  si_offset = si_low - raw_low * si_scale;
+  pct_scale = (pct_high - pct_low) / raw_span;
+  pct_offset = pct_low - raw_low * pct_scale;
+}
+
+/**
+ * Convert raw values to SI units. raw and si may be the same array
+**/
+void EV3UARTMode::raw_to_si(const float* raw, float* si, int16_t n) {
+  const float k = si_scale, b = si_offset;
+  for(int16_t i=0;i<n;i++) si[i] = raw[i] * k + b;
+}
+
+/**
+ * Convert raw values to percent. raw and pct may be the same array
+**/
+void EV3UARTMode::raw_to_pct(const float* raw, float* pct, int16_t n) {
+  const float k = pct_scale, b = pct_offset;
+  for(int16_t i=0;i<n;i++) pct[i] = raw[i] * k + b;
+}
+
+/**
+ * Scale the items of n samples of one mode in a single multiply-add loop
+**/
+static void ev3uart_scale_samples(EV3UARTSample* samples, int16_t n, float k, float b) {
+  for(int16_t i=0;i<n;i++) {
+    float* v = samples[i].value;
+    const uint8_t count = samples[i].count;
+    for(uint8_t j=0;j<count;j++) v[j] = v[j] * k + b;
+  }
+}
+
+/**
+ * Convert a batch of samples sent in this mode to SI units
+**/
+void EV3UARTMode::samples_to_si(EV3UARTSample* samples, int16_t n) {
+  ev3uart_scale_samples(samples, n, si_scale, si_offset);
+}
+
+/**
+ * Convert a batch of samples sent in this mode to percent
+**/
+void EV3UARTMode::samples_to_pct(EV3UARTSample* samples, int16_t n) {
+  ev3uart_scale_samples(samples, n, pct_scale, pct_offset);
+}
+
+/**
+ * Convert the items of a frame to float
+**/
+int16_t EV3UARTFrame::to_float(float* value) const {
+  if (decoder == NULL) return 0;
+  decoder(payload, value, count);
+  return count;
+}
+
+/**
+ * Convert the items of a frame to integers. Sign extension only, except
+ * for DATA_F
+**/
+int16_t EV3UARTFrame::to_int(int32_t* value) const {
+  EV3UARTIntDecoder decoder = ev3uart_select_int_decoder(data_type);
+  if (decoder == NULL) return 0;
+  decoder(payload, value, count);
+  return count;
+}
+
+void EV3UARTFrame::to_sample(EV3UARTSample &sample) const {
+  sample.timestamp_us = timestamp_us;
+  sample.seq = seq;
+  sample.mode = mode;
+  sample.count = to_float(sample.value);
+}
+
+/**
+ * Set the data format of the mode and select its decoder
+**/
+void EV3UARTMode::set_format(uint8_t sets, uint8_t data_type, uint8_t figures, uint8_t decimals) {
+  this->sets = sets;
+  this->data_type = data_type;
+  this->figures = figures;
+  this->decimals = decimals;
+  items = sets < MAX_DATA_ITEMS ? sets : MAX_DATA_ITEMS;
+  decoder = NULL;
+  payload_size = 0;
+  if (data_type > DATA_F || ev3uart_payload_size(data_type, sets) > MAX_PAYLOAD) return;
+  payload_size = ev3uart_payload_size(data_type, sets);
+  decoder = ev3uart_select_decoder(data_type, items);
 }
 
 /**
  * Get the mode data type as a string
 **/
-string EV3UARTMode::get_data_type_string() {
+const char* EV3UARTMode::get_data_type_string() {
   switch(data_type) {
     case 0: return "Data8";
     case 1: return "Data16";
@@ -30,48 +147,328 @@ string EV3UARTMode::get_data_type_string() {
 }
 
 /**
- * Create the sensor with the specified RX and TX pins
- * Speed starts at 2400 baud
+ * Send a heartbeat. It goes out as soon as the line is free, never inside
+ * another message, and is only dropped by reset()
 **/
 void EV3UARTSensor::send_nack(){
-	if(ss->writeable())
-	ss->putc(BYTE_NACK);
+	nack_due = true;
+	last_nack = timer->read_us();
+	tx_drain();
+}
+
+/**
+ * Queue a message to send. It is added whole or not at all, so the
+ * heartbeat is never sent in the middle of it. Returns false if the queue
+ * is full. Only called from the context that runs the parser
+**/
+bool EV3UARTSensor::send(const uint8_t* bb, uint8_t len) {
+  if ((uint16_t)(tx_buffer.capacity() - tx_buffer.size()) < len + 1) {
+    EV3UART_STAT(tx_dropped);
+    return false;
+  }
+  tx_buffer.push(len);
+  for(int i=0;i<len;i++) tx_buffer.push(bb[i]);
+  tx_drain();
+  return true;
 }
 
-/*
+/**
+ * Send queued bytes for as long as the transport is writeable. Runs from
+ * the application, the heartbeat and the TX interrupt; whichever comes
+ * while another one is draining leaves the work to it. Without a TX
+ * interrupt the rest is sent by the next call, from check_for_data()
+**/
+void EV3UARTSensor::tx_drain() {
+  if (tx_busy) {
+    // The interrupted drain enables the interrupt again when it ends
+    if (tx_interrupt) ss->enable_tx(false);
+    return;
+  }
+  tx_busy = true;
+  while(ss->writeable()) {
+    if (tx_remaining == 0) {
+      // Between messages: a due heartbeat goes first
+      if (nack_due) {
+        nack_due = false;
+        ss->putc(BYTE_NACK);
+        EV3UART_STAT(heartbeats);
+        continue;
+      }
+      uint8_t len;
+      if (!tx_buffer.pop(len)) break;
+      tx_remaining = len;
+      continue;
+    }
+    uint8_t b;
+    if (!tx_buffer.pop(b)) break;
+    ss->putc(b);
+    tx_remaining--;
+  }
+  tx_busy = false;
+  // Checked after releasing, to include a heartbeat queued meanwhile
+  if (tx_interrupt) ss->enable_tx(nack_due || !tx_buffer.empty());
+}
+
+/**
+ * Drop the queued messages and any due heartbeat, when the link is reset
+**/
+void EV3UARTSensor::tx_clear() {
+  tx_busy = true;
+  tx_buffer.clear();
+  tx_remaining = 0;
+  nack_due = false;
+  tx_busy = false;
+  if (tx_interrupt) ss->enable_tx(false);
+}
+
+/**
+ * Send a heartbeat when it is due, for timers without a periodic interrupt
+**/
 void EV3UARTSensor::sync_nack(){
+	if (this->status == DATA_MODE && (uint32_t)(timer->read_us() - last_nack) >= HEART_BEAT_PERIOD_US)
+	    send_nack();
+}
 
-	if (this->status == DATA_MODE && (tt.read_ms() - tstart)>HEART_BEAT) {
-	    this->ss->putc(BYTE_NACK);
-	    tstart=tt.read_ms();
-	  }
+/**
+ * Send a heartbeat now if in data mode. For owners that schedule heartbeats
+ * themselves, see set_external_heartbeat()
+**/
+void EV3UARTSensor::heartbeat() {
+  if (this->status == DATA_MODE) send_nack();
+}
+
+/**
+ * With external set, the sensor neither attaches a timer nor polls for
+ * heartbeats. The owner must call heartbeat() every HEART_BEAT_PERIOD_US
+**/
+void EV3UARTSensor::set_external_heartbeat(bool external) {
+  external_heartbeat = external;
+}
 
-}*/
+void EV3UARTSensor::heartbeat_handler(void* context) {
+  ((EV3UARTSensor*) context)->heartbeat();
+}
+
+void EV3UARTSensor::rx_handler(void* context) {
+  ((EV3UARTSensor*) context)->rx_isr();
+}
 
+void EV3UARTSensor::tx_handler(void* context) {
+  ((EV3UARTSensor*) context)->tx_drain();
+}
+
+/**
+ * Create the sensor. Speed starts at 2400 baud
+**/
 EV3UARTSensor::EV3UARTSensor(){
   ss = NULL;
+  timer = NULL;
+  heart_attached = false;
+  external_heartbeat = false;
+  cache = NULL;
+  from_cache = false;
+  skip_cache = false;
+  data_start = 0;
+  last_nack = 0;
   status = RESET;
   speed = 2400;
   mode = -1;
+  ext_mode = EXT_MODE_0;
   num_samples = 1;
+  sample_seq = 0;
+  modes = 0;
+  switch_state = SWITCH_IDLE;
+  switch_latency = 0;
+  switch_handler = NULL;
+  switch_context = NULL;
+  frame_handler = NULL;
+  frame_context = NULL;
+  watchdog_us = WATCHDOG_TIMEOUT_US;
+  for(int i=0;i<MAX_MODES;i++) filter_state[i] = 0xFF;
+  classifier = NULL;
+  classifier_mode = RGBRaw;
+  connect_start = 0;
+  connect_timeout = 0;
+  handshake = HANDSHAKE_NONE;
+  info_count = 0;
+  for(int i=0;i<HANDSHAKE_STEPS;i++) handshake_us[i] = 0;
+  watchdog_handler = NULL;
+  watchdog_context = NULL;
+  last_frame = 0;
+  frame_period = 0;
+  last_frame_mode = 0xFF;
+  clear_stats();
+  writing = 0;
+  published = 0;
+  for(int i=0;i<2;i++) {
+    latest[i].timestamp_us = 0;
+    latest[i].seq = 0;
+    latest[i].mode = 0;
+    latest[i].count = 0;
+    latest[i].data_type = DATA_8;
+    latest[i].decoder = NULL;
+    memset(latest[i].payload, 0, MAX_PAYLOAD);
+    filtered_count[i] = 0;
+    color[i] = COLOR_NONE;
+    color_confidence[i] = 0;
+  }
+  rx_interrupt = false;
+  msg_len = 0;
+  msg_pos = 0;
+  replay_len = 0;
+  replay_pos = 0;
+  ack_pending = false;
+  tx_interrupt = false;
+  tx_busy = false;
+  nack_due = false;
+  tx_remaining = 0;
+}
+
+
+
+
+/**
+ * Use a metadata cache. After a handshake the sensor's metadata is stored in
+ * it, and when a sensor of a cached type connects it is acknowledged as soon
+ * as its CMD_TYPE message arrives
+**/
+void EV3UARTSensor::set_cache(EV3UARTMetadataCache* cache) {
+  this->cache = cache;
+}
+
+/**
+ * Copy the metadata received in the handshake
+**/
+void EV3UARTSensor::get_metadata(EV3UARTMetadata &metadata) {
+  metadata.type = type;
+  metadata.modes = modes;
+  metadata.views = views;
+  metadata.speed = speed;
+  metadata.no_early_ack = false;
+  for(int i=0;i<MAX_MODES;i++) metadata.mode[i] = mode_array[i];
+}
+
+/**
+ * The sensor did not take the early ACK. Do the next handshake in full and
+ * never acknowledge its type early again
+**/
+void EV3UARTSensor::reject_cache() {
+  skip_cache = true;
+  if (cache) cache->reject_early_ack(type);
 }
 
+void EV3UARTSensor::set_metadata(const EV3UARTMetadata &metadata) {
+  type = metadata.type;
+  modes = metadata.modes;
+  views = metadata.views;
+  speed = metadata.speed;
+  for(int i=0;i<MAX_MODES;i++) mode_array[i] = metadata.mode[i];
+}
 
+/**
+ * True if the last handshake was completed from the cache
+**/
+bool EV3UARTSensor::connected_from_cache() {
+  return from_cache;
+}
 
+/**
+ * Get a consistent copy of the statistics. Counters only grow, so two equal
+ * copies in a row show a moment when all of them had those values. All zero
+ * when EV3UART_STATS is 0
+**/
+void EV3UARTSensor::get_stats(EV3UARTStats &out) {
+#if EV3UART_STATS
+  EV3UARTStats again;
+  do {
+    out = *(EV3UARTStats*) &stats;
+    EV3UART_BARRIER();
+    again = *(EV3UARTStats*) &stats;
+  } while(memcmp(&out, &again, sizeof(out)) != 0);
+#else
+  memset(&out, 0, sizeof(out));
+#endif
+  out.rx_overruns = rx_buffer.get_overruns();
+}
+
+/**
+ * Set all the statistics to zero. Not to be used while another context updates them
+**/
+void EV3UARTSensor::clear_stats() {
+#if EV3UART_STATS
+  memset((void*) &stats, 0, sizeof(stats));
+#endif
+}
 
 /**
  * Get the mode object for a specific mode
 **/
 EV3UARTMode* EV3UARTSensor::get_mode(int16_t mode) {
-  return mode_array[mode];
+  if (mode < 0 || mode >= MAX_MODES) return NULL;
+  return &mode_array[mode];
 }
 
 /**
- * Start communication with the sensor
+ * Start communication with the sensor over any transport.
+ * With rx_interrupt set, received bytes are moved into a ring buffer by the
+ * RX interrupt so none are lost while the application loop is busy. It is
+ * ignored if the transport has no RX interrupt.
+ * Messages to the sensor are queued and sent from the TX interrupt when the
+ * transport has one, otherwise from check_for_data().
 **/
-void EV3UARTSensor::begin(RawSerial &serial) {
-  ss= &serial;
+void EV3UARTSensor::begin(EV3UARTTransport &transport, EV3UARTTimer &timer, bool rx_interrupt) {
+  ss = &transport;
+  this->timer = &timer;
   ss->baud(2400);
+  rx_buffer.clear();
+  this->rx_interrupt = rx_interrupt && ss->attach_rx(&EV3UARTSensor::rx_handler,this);
+  tx_interrupt = ss->attach_tx(&EV3UARTSensor::tx_handler,this);
+  tx_clear();
+}
+
+#ifndef EV3UART_HOST
+/**
+ * Start communication with the sensor on an mbed serial port
+**/
+void EV3UARTSensor::begin(RawSerial &serial, bool rx_interrupt) {
+  mbed_transport.set_serial(serial);
+  begin(mbed_transport, mbed_timer, rx_interrupt);
+}
+#endif
+
+/**
+ * RX interrupt handler. Only producer of rx_buffer.
+**/
+void EV3UARTSensor::rx_isr() {
+  while(ss->readable())
+    rx_buffer.push((uint8_t) ss->getc());
+}
+
+/**
+ * True if a received byte is ready to be processed
+**/
+bool EV3UARTSensor::rx_available() {
+  if (rx_interrupt) return !rx_buffer.empty();
+  return ss->readable();
+}
+
+/**
+ * Take the next received byte. Only valid after rx_available() returned true
+**/
+uint8_t EV3UARTSensor::rx_get() {
+  if (rx_interrupt) {
+    uint8_t b = 0;
+    rx_buffer.pop(b);
+    return b;
+  }
+  return ss->getc();
+}
+
+/**
+ * Number of received bytes dropped because the receive buffer was full
+**/
+uint32_t EV3UARTSensor::get_rx_overruns() {
+  return rx_buffer.get_overruns();
 }
 
 /**
@@ -85,324 +482,460 @@ void EV3UARTSensor::end() {
  * Reset the sensor. It will revert to mode zero.
 **/
 void EV3UARTSensor::reset() {
+  EV3UART_STAT(resets);
   status = RESET;
   this->speed = 2400;
+  msg_len = 0;
+  replay_len = 0;
+  replay_pos = 0;
+  ack_pending = false;
+  ext_mode = EXT_MODE_0;
+  switch_state = SWITCH_IDLE;
+  handshake = HANDSHAKE_NONE;
+  // The sensor that connects next may not be the one the windows hold
+  for(uint8_t i=0;i<FILTER_STATES;i++) filter[i].reset();
+  tx_clear();
   //ss->close();
   ss->baud(2400);
 }
 
 /**
- * This does most of the work. Must be called very frequently. The metadata is processed and the mode objects created.
- * When this is complete, the bit rate is increased and the data is processed.
+ * Wait until the handshake is complete and the sensor is in data mode, or
+ * until timeout_us has passed if it is not 0. Returns false on timeout.
+ * Built on connect_step(), which can be used instead from the main loop
 **/
-void EV3UARTSensor::connect(){
-	while(status!=DATA_MODE)
-		this->check_for_data();
+bool EV3UARTSensor::connect(uint32_t timeout_us){
+	uint8_t state;
+	this->start_connect(timeout_us);
+	while((state = this->connect_step()) == CONNECT_PENDING);
+	return state == CONNECT_DONE;
 }
 
-void EV3UARTSensor::connect(DigitalOut &led){
-	while(status!=DATA_MODE){
-		this->check_for_data();
-		led=!led;
+#ifndef EV3UART_HOST
+/**
+ * Same as connect(), blinking led every CONNECT_LED_PERIOD_US while waiting
+**/
+bool EV3UARTSensor::connect(DigitalOut &led, uint32_t timeout_us){
+	uint8_t state;
+	uint32_t toggled = timer->read_us();
+	this->start_connect(timeout_us);
+	while((state = this->connect_step()) == CONNECT_PENDING){
+		if ((uint32_t)(timer->read_us() - toggled) >= CONNECT_LED_PERIOD_US) {
+			toggled += CONNECT_LED_PERIOD_US;
+			led=!led;
+		}
 	}
 	led = 1;
+	return state == CONNECT_DONE;
+}
+#endif
+
+/**
+ * Start a handshake with an optional time limit. The times in
+ * get_progress() are counted from here. Nothing is sent or waited for
+**/
+void EV3UARTSensor::start_connect(uint32_t timeout_us) {
+  connect_start = timer->read_us();
+  connect_timeout = timeout_us;
+  for(int i=0;i<HANDSHAKE_STEPS;i++) handshake_us[i] = 0;
+}
+
+/**
+ * Process what has been received, as check_for_data() does, and report
+ * whether the sensor is in data mode or the time of start_connect() is up.
+ * Each call takes as long as one check_for_data(), so it can be called from
+ * the main loop for every port without delaying the others
+**/
+uint8_t EV3UARTSensor::connect_step() {
+  this->check_for_data();
+  return connect_state();
+}
+
+uint8_t EV3UARTSensor::connect_state() {
+  if (this->status == DATA_MODE) return CONNECT_DONE;
+  if (connect_timeout && (uint32_t)(timer->read_us() - connect_start) >= connect_timeout)
+    return CONNECT_TIMEOUT;
+  return CONNECT_PENDING;
+}
+
+/**
+ * Copy the progress of the handshake. The difference between the times of
+ * two steps is how long the sensor took between them
+**/
+void EV3UARTSensor::get_progress(EV3UARTProgress &out) {
+  out.state = connect_state();
+  out.step = handshake;
+  out.info_count = info_count;
+  out.from_cache = from_cache;
+  out.elapsed_us = timer->read_us() - connect_start;
+  for(int i=0;i<HANDSHAKE_STEPS;i++) out.step_us[i] = handshake_us[i];
 }
 
+/**
+ * Record that the handshake reached step. A new CMD_TYPE starts it again
+**/
+void EV3UARTSensor::handshake_step(uint8_t step) {
+  if (step == HANDSHAKE_TYPE) {
+    info_count = 0;
+    for(int i=HANDSHAKE_TYPE;i<HANDSHAKE_STEPS;i++) handshake_us[i] = 0;
+  }
+  if (step == HANDSHAKE_INFO) info_count++;
+  // For INFO, the time of the first one
+  if (handshake != step) handshake_us[step] = timer->read_us() - connect_start;
+  handshake = step;
+}
+
+/**
+ * Process every byte received since the last call. Never waits for bytes that
+ * have not arrived yet: a partial message is kept and completed on a later call.
+**/
 void EV3UARTSensor::check_for_data() {
-  // Send heart beat messages if in data mode
-  // Process bytes from the sensor
-
-
-   //uint32_t primaskValue = 0U;
-   //primaskValue = DisableGlobalIRQ();
-
-  if(ss->readable()) {
-    uint8_t cmd = ss->getc();
-	if (this->status == DATA_MODE) {
-#ifdef DEBUG
-	  Serial.print("Data received ");
-      Serial.println(cmd, HEX);
-#endif	 
-      // If in data mode, process the data command and set the current value(s)
-      if ((cmd & CMD_MASK) == CMD_DATA) {
-    	uint8_t lll = (cmd & CMD_LLL_MASK) >> CMD_LLL_SHIFT;
-    	uint8_t l = this->exp2(lll); // Number of extra bytes
-    	uint8_t mode = (cmd & 7); // The current mode
-    	uint8_t checksum = 0xff ^ cmd;
-    	uint8_t bb[l];
-#ifdef DEBUG
-		//Serial.print("Data message: mode: ");
-		//Serial.print(mode);
-		//Serial.print(" length: ");
-		//Serial.println(l);
-#endif
-        for(int i=0;i<l;i++) {
-          bb[i] = this->read_byte();
-          checksum ^= bb[i];
-        }
-        uint8_t sum = this->read_byte();
-        // The Color sensor calculates checksums incorrectly in RGB mode
-        if ((this->type == TYPE_COLOR && mode == 4) || checksum == sum) {
-#ifdef DEBUG
-        //Serial.print("Valid data message : ");
-        //Serial.print("Data is ");
-#endif
-		  this->consecutive_errors = 0;
-		  recent_messages++;
-		  // Extract the data from the message using type information from INFO messages
-		  for(int i=0;i<num_samples;i++) {	  
-		    switch(mode_array[mode]->data_type) {
-		      case 0: this->value[i] = (float) bb[i]; break;
-              case 1: this->value[i] = (float) get_int(bb,i*2); break;
-              case 2: this->value[i] = (float) get_long(bb,i*4); break;
-              case 3: this->value[i] = get_float(bb,i*4); break;	
-			}
-#ifdef DEBUG
-          //    Serial.print(this->value[i]);
-         //     Serial.print(" ");
-#endif
-		  }
-#ifdef DEBUG
-          //Serial.println();
-#endif
-        } else {
-#ifdef DEBUG
-         /* Serial.println("Data checksum error");
-		  Serial.print("  Message: ");
-		  Serial.print(cmd,HEX);
-		  Serial.print(" ");
-		  for(int  i=0;i<l;i++) {
-		    Serial.print(bb[i],HEX);
-			Serial.print(" ");
-	      }
-		  Serial.print("  Calculated: ");
-		  Serial.print(checksum, HEX);
-		  Serial.print("  Received: ");
-		  Serial.println(sum, HEX);*/
-#endif	
-		  this->data_errors++;
-		  printf("%d\n",data_errors);
-		  // If more than 6 errors occur in a row, reset the connection
-		  if (this->consecutive_errors++ > 6) reset();
-        }
-	  }
-	  // Ignore all messages except CMD_TYPE until we get a valid CMD_TYPE message
-	} else if (this->status == STARTED || cmd == CMD_TYPE) {
-	  if (cmd == BYTE_ACK) {
-	    // Ack receive
-#ifdef DEBUG
-		/*Serial.println("Ack received");
-		Serial.print("Setting speed to: ");
-        Serial.println(this->speed);*/
-#endif
-        // An ACK is sent by the sensor after all the metadata is sent
-		// Send an ACK back, wait a while, and then change the speed
-		// to the one given in the CMD_SPEED message
-        //uint8_t c;
-    	while(ss->readable())
-    		ss->getc();
-    	ss->putc(BYTE_ACK);
- 	 	delay_ms(10);
- 	 	ss->baud(speed);
- 	 	this->status = DATA_MODE;
-		this->data_errors = 0;
-		this->consecutive_errors = 0;
-		this->recent_messages = 0;
-		ss->putc(BYTE_NACK);
-		this->heart.attach_us(callback(this,&EV3UARTSensor::send_nack),95000);
-
-	  } else if (cmd == CMD_TYPE) {
-#ifdef DEBUG
-	    //Serial.println("Type command");
+#if EV3UART_STATS
+  uint32_t start = timer->read_us();
 #endif
-        // Tpe command is the first metadata command. Extract the type field
-        uint8_t checksum = 0xff ^ cmd;
-        uint8_t type = this->read_byte();
-        checksum ^= type;
-        if (checksum == this->read_byte()) {
-		  this->type = type;
-          this->status = STARTED;
-#ifdef DEBUG
-		  //Serial.print("Valid type message : ");
-		  //Serial.println(type);
-#endif		  
-        } else {
-#ifdef DEBUG		
-		  //Serial.println("Type invalid checksum");
-#endif
-        	//printf("Type invalid checksum\n");
-		}
-	  } else if (cmd == CMD_MODES) {
-	    // The mode command comes after the type command.
-		// Extract the number of modes and views
-		uint8_t checksum = 0xff ^ cmd;
-		uint8_t modes = this->read_byte();
-        checksum ^= modes;
-        uint8_t views = this->read_byte();
-        checksum ^= views;
-        if (checksum == this->read_byte()) {
-		  this->views = views;
-		  this->modes = modes + 1;
-		  // Create a mode object for each of the modes
-		  for(int i =0;i<=modes && i < MAX_MODES;i++) {
-		    this->mode_array[i] = new EV3UARTMode();;
-		  }
-#ifdef DEBUG
-          /*Serial.print("Valid modes message: ");
-          Serial.print("modes = ");
-          Serial.print(modes);
-          Serial.print(" views = ");
-          Serial.println(views);*/
-#endif
-        } else {
-#ifdef DEBUG
-          //Serial.println("Invalid modes checksum");
-#endif		  
-        	//printf("Invalid modes checksum\n");
-        }
-	  } else if (cmd == CMD_SPEED) {
-	    // The speed command comes after the MODES command
-		// Extract the bit rate to use in data mode
-		uint8_t checksum = 0xff ^ cmd;
-		uint8_t bb[4];
-        for(int i=0;i<4;i++) {
-          uint8_t b = this->read_byte();
-          checksum ^= b;
-          bb[i] = b;
-        }
-        if (checksum == this->read_byte()) {
-	      this->speed  = this->get_long(bb, 0);
-
-	      //printf("speed %d\n",this->speed);
-#ifdef DEBUG		  
-         /* Serial.print("Valid speed message: ");
-          Serial.print("Speed: ");
-          Serial.println(speed);*/
-
-#endif		  
-        } else {
-          //Serial.println("Invalid speed checksum");
-        	//printf("Invalid speed checksum\n");
-        }
-	  } else if ((cmd & CMD_MASK) == CMD_INFO) {
-#ifdef DEBUG
-       // Serial.print("Info message: ");
+  while(rx_available())
+    parse_byte(rx_get());
+
+  // Complete the switch to data mode once the sensor has had time to see our ACK
+  if (ack_pending && (uint32_t)(timer->read_us() - ack_time) >= ACK_DELAY_US) {
+    ack_pending = false;
+    ss->baud(speed);
+    this->status = DATA_MODE;
+    this->consecutive_errors = 0;
+    this->recent_messages = 0;
+    data_start = timer->read_us();
+    last_frame = data_start;
+    frame_period = 0;
+    last_frame_mode = 0xFF;
+    handshake_step(HANDSHAKE_DATA);
+    send_nack();
+    if (!external_heartbeat)
+      heart_attached = timer->attach_us(&EV3UARTSensor::heartbeat_handler,this,HEART_BEAT_PERIOD_US);
+  }
+  if (!heart_attached && !external_heartbeat) sync_nack();
+  if (!tx_interrupt) tx_drain();
+
+  // The sensor may have missed the CMD_SELECT
+  if (switch_state == SWITCH_PENDING && status == DATA_MODE &&
+      (uint32_t)(timer->read_us() - switch_sent) >= SWITCH_RETRY_US) {
+    switch_sent = timer->read_us();
+    this->send_select(switch_target);
+  }
+
+  // A sensor that does not accept the early ACK keeps sending its handshake at
+  // the old speed. Give up on the cache and wait for the full handshake
+  if (from_cache && status == DATA_MODE && recent_messages == 0 &&
+      (uint32_t)(timer->read_us() - data_start) >= CACHE_FALLBACK_US) {
+    reject_cache();
+    reset();
+  }
+
+  // A sensor that stops sending has been unplugged or has lost power. Wait
+  // for it to start the handshake again
+  uint32_t timeout = get_watchdog_timeout();
+  if (timeout && status == DATA_MODE) {
+    uint32_t silence = timer->read_us() - last_frame;
+    if (silence >= timeout) {
+      if (from_cache && recent_messages == 0) reject_cache();
+      EV3UART_STAT(watchdog_timeouts);
+      reset();
+      if (watchdog_handler) watchdog_handler(watchdog_context, silence);
+    }
+  }
+
+#if EV3UART_STATS
+  uint32_t elapsed = timer->read_us() - start;
+  stats.check_calls++;
+  stats.check_time_us += elapsed;
+  if (elapsed > stats.check_max_us) stats.check_max_us = elapsed;
 #endif
-        // A series of INFO commands are given for each mode
-		// Modes count down from the highest to zero
-		uint8_t lll = (cmd & CMD_LLL_MASK) >> CMD_LLL_SHIFT;
-		uint8_t l = this->exp2(lll);
-		uint8_t mode = (cmd & CMD_MMM_MASK);
-		uint8_t checksum = 0xFF ^ cmd;
-		uint8_t type = this->read_byte();
-        checksum ^= type;
-        uint8_t bb[l];
-        for(int i=0;i<l;i++) {
-          uint8_t b = this->read_byte();
-          checksum ^= b;
-          bb[i] = b;
-        } 
-		string modeName, symbol;
-		float low, high;
-        if (checksum != this->read_byte()) {
-          //printf("Invalid info checksum\n");
-        } else {
-          switch(type) {
-            case 0:
-			    // The mode name
-			    modeName = this->get_string(bb,l);
-				this->mode_array[mode]->name = modeName;
-#ifdef DEBUG
-              /*Serial.print("Name: ");
-              Serial.println(modeName);*/
-#endif			  
-              break;
-            case 1:
-			  // The range of raw values
-			  low = this->get_float(bb,0);
-			  high = this->get_float(bb,4);
-			  mode_array[mode]->raw_low = low;
-			  mode_array[mode]->raw_high = high;
-#ifdef DEBUG			
-             /* Serial.print("Raw: ");
-              Serial.print(low);
-              Serial.print(" ");
-              Serial.println(high);*/
-#endif			  
-              break;
-            case 2:
-			  // The range of percentage values
-			  low = this->get_float(bb,0);
-			  high = this->get_float(bb,4);
-			  mode_array[mode]->pct_low = low;
-			  mode_array[mode]->pct_high = high;
-#ifdef DEBUG			
-             /* Serial.print("Pct: ");
-              Serial.print(low);
-              Serial.print(" ");
-              Serial.println(high);*/
-#endif			  
-              break;        
-            case 3:
-			  // The range of SI values
-			  low = this->get_float(bb,0);
-			  high = this->get_float(bb,4);
-			  mode_array[mode]->si_low = low;
-			  mode_array[mode]->si_high = high;
-#ifdef DEBUG			
-              /*Serial.print("Si: ");
-              Serial.print(low);
-              Serial.print(" ");
-              Serial.println(high);*/
-#endif			  
-              break;
-            case 4:
-			  // The unit symbol
-			  symbol = this->get_string(bb,l);
-			  mode_array[mode]->symbol = symbol;
-#ifdef DEBUG			
-             /* Serial.print("Symbol: ");
-              Serial.println(symbol);*/
-#endif			  
-              break;
-            case 0x80:
-			  // The data format including number of data items,
-			  // the data time and the number of signicant digits
-			  mode_array[mode]->sets = bb[0];
-			  mode_array[mode]->data_type = bb[1];
-			  mode_array[mode]->figures = bb[2];
-			  mode_array[mode]->decimals = bb[3];
-#ifdef DEBUG			
-           /*   Serial.print("Format: ");
-              Serial.print(" Sets: ");
-              Serial.print(bb[0]);
-              Serial.print(" Data Type: ");
-              Serial.print(this->get_data_type(bb[1]));
-              Serial.print(" ");
-              Serial.print(" Figures: ");
-              Serial.print(bb[2]);
-              Serial.print(" Decimals: ");
-              Serial.print(bb[3]); 
-			  // After a format commmand for mode 0 is given, an ACK will be sent
-			  // and we reply to it, change the speed, and go into data mode.
-              Serial.print(" Mode ");
-              Serial.println(mode);*/
-#endif         
-             break;
-          }
-        }
-	  }
-	}
+}
+
+/**
+ * Feed bytes from any source to the parser
+**/
+void EV3UARTSensor::feed(const uint8_t* bb, size_t len) {
+  for(size_t i=0;i<len;i++)
+    parse_byte(bb[i]);
+}
+
+/**
+ * Add one byte to the parser, then any bytes handed back by a corrupted frame
+**/
+void EV3UARTSensor::parse_byte(uint8_t b) {
+  accept_byte(b);
+  while(replay_pos < replay_len)
+    accept_byte(replay[replay_pos++]);
+}
+
+/**
+ * Add one byte to the message being collected and process the message
+ * when it is complete
+**/
+void EV3UARTSensor::accept_byte(uint8_t b) {
+  // Bytes sent between our ACK and the speed change are meaningless
+  if (ack_pending) return;
+  if (msg_len == 0) {
+    uint8_t len = this->message_length(b);
+    if (len == 0) {
+      // Not the start of a message we want
+      EV3UART_STAT(bytes_discarded);
+      return;
+    }
+    msg[0] = b;
+    msg_pos = 1;
+    msg_len = len;
+  } else {
+    msg[msg_pos++] = b;
   }
+  if (msg_pos == msg_len) {
+    uint8_t len = msg_len;
+    msg_len = 0;
+    this->process_message(len);
+  }
+}
 
+/**
+ * A DATA frame of len bytes in msg was corrupted, so its header may not have
+ * been a header at all. Hand every byte after it back to the parser to look
+ * for the next valid frame, instead of losing frame alignment
+**/
+void EV3UARTSensor::resync(uint8_t len) {
+  uint8_t rest[MAX_MESSAGE_SIZE];
+  uint8_t n = replay_len - replay_pos;
+  // Bytes of the frame come first, then those not replayed yet
+  memcpy(rest, replay + replay_pos, n);
+  memcpy(replay, msg + 1, len - 1);
+  memcpy(replay + len - 1, rest, n);
+  replay_pos = 0;
+  replay_len = len - 1 + n;
 }
 
 /**
- * Utility method to read a byte synchronously
+ * Get the total length of the message that starts with cmd, including the
+ * checksum. Zero if the byte is to be ignored in the current status
 **/
-uint8_t EV3UARTSensor::read_byte() {
-  while(!ss->readable());
-  return ss->getc();
+uint8_t EV3UARTSensor::message_length(uint8_t cmd) {
+  uint8_t l = this->exp2((cmd & CMD_LLL_MASK) >> CMD_LLL_SHIFT);
+  if (l == 0) return 0;
+  if (this->status == DATA_MODE) {
+    // In data mode only data and EXT_MODE messages are processed, and data
+    // messages only for a mode the sensor announced, with the length of its format
+    if (cmd == CMD_EXT_MODE) return 1 + l + 1;
+    if ((cmd & CMD_MASK) != CMD_DATA) return 0;
+    uint8_t mode = (cmd & CMD_MMM_MASK) + ext_mode;
+    if (mode >= modes || mode >= MAX_MODES) return 0;
+    const EV3UARTMode &m = mode_array[mode];
+    if (m.decoder == NULL || l != m.payload_size) return 0;
+    return 1 + l + 1;
+  }
+  // Ignore all messages except CMD_TYPE until we get a valid CMD_TYPE message
+  if (this->status != STARTED && cmd != CMD_TYPE) return 0;
+  if (cmd == BYTE_ACK) return 1;
+  switch(cmd & CMD_MASK) {
+    case CMD_COMMAND: return 1 + l + 1;
+    case CMD_INFO: return 1 + 1 + l + 1;  // INFO messages carry an extra type byte
+    default: return 0;
+  }
+}
+
+/**
+ * Process a complete message of len bytes held in msg
+**/
+void EV3UARTSensor::process_message(uint8_t len) {
+  uint8_t cmd = msg[0];
+  uint8_t sum = msg[len-1];
+  uint8_t checksum = this->checksum(msg, len-1);
+
+  if (this->status == DATA_MODE && cmd == CMD_EXT_MODE) {
+    // Sensors with more than 8 modes send this before DATA messages of
+    // modes 8 and above, and before the others once they used one of those
+    if (checksum == sum) ext_mode = (msg[1] == EXT_MODE_8) ? EXT_MODE_8 : EXT_MODE_0;
+    else EV3UART_STAT(checksum_errors);
+  } else if (this->status == DATA_MODE) {
+    // Process the data command and set the current value(s). The frame
+    // is decoded with the format of its own mode, whatever mode was requested
+    uint8_t mode = (cmd & CMD_MMM_MASK) + ext_mode;
+    const EV3UARTMode &m = mode_array[mode];
+    // The Color sensor calculates checksums incorrectly in RGB mode
+    if ((this->type == TYPE_COLOR && mode == 4) || checksum == sum) {
+      this->consecutive_errors = 0;
+      recent_messages++;
+      // Copy into the slot readers are not using, then make it the latest.
+      // Readers copy the latest slot and retry only if two more frames were
+      // published meanwhile, so no interrupts have to be disabled. The
+      // payload is converted by the readers, see EV3UARTFrame
+      uint32_t n = writing + 1;
+      writing = n;
+      EV3UART_BARRIER();
+      EV3UARTFrame &frame = latest[n & 1];
+      memcpy(frame.payload, msg+1, m.payload_size);
+      frame.timestamp_us = timer->read_us();
+      // Average the time between frames of one mode, for the watchdog. A
+      // new mode may stream at another rate, so its period is measured anew
+      if (mode == last_frame_mode) {
+        uint32_t interval = frame.timestamp_us - last_frame;
+        frame_period = frame_period ? frame_period - frame_period / 8 + interval / 8 : interval;
+      } else {
+        frame_period = 0;
+      }
+      last_frame_mode = mode;
+      last_frame = frame.timestamp_us;
+      frame.seq = sample_seq++;
+      frame.mode = mode;
+      frame.count = m.items;
+      frame.data_type = m.data_type;
+      frame.decoder = m.decoder;
+      // Run the mode's filter. Each filtered mode has its own state
+      filtered_count[n & 1] = 0;
+      uint8_t state = filter_state[mode];
+      if (state != 0xFF) {
+        float value[MAX_DATA_ITEMS];
+        m.decoder(frame.payload, value, m.items);
+        uint8_t k = m.items < FILTER_ITEMS ? m.items : FILTER_ITEMS;
+        filter[state].update(value, filtered[n & 1], k);
+        filtered_count[n & 1] = k;
+      }
+      // Classify the colour of RGB frames, in integers
+      color[n & 1] = COLOR_NONE;
+      color_confidence[n & 1] = 0;
+      if (classifier && mode == classifier_mode && m.items >= 3) {
+        int32_t rgb[MAX_DATA_ITEMS];
+        frame.to_int(rgb);
+        color[n & 1] = classifier->classify(rgb[0], rgb[1], rgb[2], color_confidence[n & 1]);
+      }
+      EV3UART_BARRIER();
+      published = n;
+      // Keep the frame for fetch_samples()
+      history.push(frame);
+      EV3UART_STAT(frames);
+      // The current mode is the one the sensor is sending in
+      this->mode = mode;
+      this->num_samples = m.items;
+      if (switch_state == SWITCH_PENDING && mode == switch_target) {
+        switch_latency = frame.timestamp_us - switch_start;
+        switch_state = SWITCH_DONE;
+        if (switch_handler) switch_handler(switch_context, mode, switch_latency);
+      }
+      if (frame_handler) frame_handler(frame_context, frame);
+    } else {
+      EV3UART_STAT(checksum_errors);
+      // If errors keep occurring after resynchronising, the link is lost
+      if (this->consecutive_errors++ >= MAX_CONSECUTIVE_ERRORS) reset();
+      else resync(len);
+    }
+  } else if (cmd == BYTE_ACK) {
+    // An ACK is sent by the sensor after all the metadata is sent.
+    // Send an ACK back and change the speed to the one given in the
+    // CMD_SPEED message once ACK_DELAY_US has passed
+    uint8_t ack = BYTE_ACK;
+    send(&ack, 1);
+    ack_time = timer->read_us();
+    ack_pending = true;
+    from_cache = false;
+    handshake_step(HANDSHAKE_ACK);
+    skip_cache = false;
+    if (cache) {
+      EV3UARTMetadata metadata;
+      get_metadata(metadata);
+      cache->store(metadata);
+    }
+  } else if (checksum != sum) {
+    EV3UART_STAT(checksum_errors);
+  } else if (cmd == CMD_TYPE) {
+    // Type command is the first metadata command. Extract the type field
+    this->type = msg[1];
+    this->status = STARTED;
+    handshake_step(HANDSHAKE_TYPE);
+    // For a known type, acknowledge now and skip the rest of the handshake
+    const EV3UARTMetadata* cached = (cache && !skip_cache) ? cache->find(type) : NULL;
+    if (cached && !cached->no_early_ack) {
+      set_metadata(*cached);
+      uint8_t ack = BYTE_ACK;
+      send(&ack, 1);
+      ack_time = timer->read_us();
+      ack_pending = true;
+      from_cache = true;
+      handshake_step(HANDSHAKE_ACK);
+    }
+  } else if ((cmd & ~CMD_LLL_MASK) == (CMD_MODES & ~CMD_LLL_MASK)) {
+    // The mode command comes after the type command.
+    // Extract the number of modes and views. Sensors with more than 8
+    // modes add two bytes with the full numbers
+    uint8_t modes = msg[1];
+    this->views = msg[2];
+    if (len >= 6) {
+      modes = msg[3];
+      this->views = msg[4];
+    }
+    this->modes = modes + 1;
+    handshake_step(HANDSHAKE_MODES);
+    // Clear the mode object of each of the modes
+    for(int i =0;i<=modes && i < MAX_MODES;i++) {
+      this->mode_array[i] = EV3UARTMode();
+    }
+  } else if (cmd == CMD_SPEED) {
+    // The speed command comes after the MODES command
+    // Extract the bit rate to use in data mode
+    this->speed  = this->get_long(msg, 1);
+    handshake_step(HANDSHAKE_SPEED);
+  } else if ((cmd & CMD_MASK) == CMD_INFO) {
+    // A series of INFO commands are given for each mode
+    // Modes count down from the highest to zero
+    uint8_t mode = (cmd & CMD_MMM_MASK);
+    uint8_t type = msg[1];
+    if (type & INFO_MODE_PLUS_8) {
+      mode += 8;
+      type &= ~INFO_MODE_PLUS_8;
+    }
+    handshake_step(HANDSHAKE_INFO);
+    // Metadata of modes that do not fit is ignored, their frames are rejected
+    if (mode >= MAX_MODES) return;
+    uint8_t* bb = msg+2;
+    uint8_t l = len-3;
+    switch(type) {
+      case 0:
+        // The mode name
+        this->get_string(mode_array[mode].name,MODE_NAME_SIZE,bb,l);
+        break;
+      case 1:
+        // The range of raw values
+        mode_array[mode].raw_low = this->get_float(bb,0);
+        mode_array[mode].raw_high = this->get_float(bb,4);
+        mode_array[mode].update_scale();
+        break;
+      case 2:
+        // The range of percentage values
+        mode_array[mode].pct_low = this->get_float(bb,0);
+        mode_array[mode].pct_high = this->get_float(bb,4);
+        mode_array[mode].update_scale();
+        break;
+      case 3:
+        // The range of SI values
+        mode_array[mode].si_low = this->get_float(bb,0);
+        mode_array[mode].si_high = this->get_float(bb,4);
+        mode_array[mode].update_scale();
+        break;
+      case 4:
+        // The unit symbol
+        this->get_string(mode_array[mode].symbol,MODE_SYMBOL_SIZE,bb,l);
+        break;
+      case 0x80:
+        // The data format including number of data items,
+        // the data time and the number of signicant digits
+        mode_array[mode].set_format(bb[0], bb[1], bb[2], bb[3]);
+        break;
+    }
+  }
+}
+
+/**
+ * Utility method to calculate the checksum of len bytes
+**/
+uint8_t EV3UARTSensor::checksum(const uint8_t* bb, int16_t len) {
+  uint8_t checksum = 0xff;
+  for(int i=0;i<len;i++) checksum ^= bb[i];
+  return checksum;
 }
 
 /**
@@ -414,15 +947,15 @@ uint32_t EV3UARTSensor::get_long(uint8_t* bb, int16_t offset) {
 }
 
 /**
- * Utility method to get a string from a byte array
+ * Utility method to copy a string from a byte array into s, truncated to size
 **/
-string EV3UARTSensor::get_string(uint8_t* bb, int16_t len) {
-  string s = "";
-  for(int i=0;i<len;i++) {
+void EV3UARTSensor::get_string(char* s, int16_t size, uint8_t* bb, int16_t len) {
+  int i;
+  for(i=0;i<len && i<size-1;i++) {
     if (bb[i] == 0) break;
-    s += (char) bb[i];
+    s[i] = (char) bb[i];
   }
-  return s;
+  s[i] = 0;
 }
 
 /**
@@ -438,13 +971,6 @@ float EV3UARTSensor::get_float(uint8_t *bb, int16_t offset) {
   return data.f;
 }
 
-/**
- * Utility method to get an int from a byte array
-**/
-int16_t EV3UARTSensor::get_int(uint8_t* bb, int16_t offset) {
-  return ((int16_t) bb[offset]) | ((int16_t) bb[offset+1] << 8);
-}
-
 /**
  * Utility method t return a small power of 2
 **/
@@ -463,7 +989,7 @@ int16_t EV3UARTSensor::exp2(int16_t val) {
 /**
  * Debugging method to convert INFO message type to a string
 **/
-string EV3UARTSensor::get_info_type(int16_t val) {
+const char* EV3UARTSensor::get_info_type(int16_t val) {
   switch(val) {
     case 0: return "Name";
     case 1: return "Raw";
@@ -478,7 +1004,7 @@ string EV3UARTSensor::get_info_type(int16_t val) {
 /**
  * Utility method to convert a data type to a string
 **/  
-string EV3UARTSensor::get_data_type(int16_t val) {
+const char* EV3UARTSensor::get_data_type(int16_t val) {
   switch(val) {
     case 0: return "Data8";
     case 1: return "Data16";
@@ -489,38 +1015,127 @@ string EV3UARTSensor::get_data_type(int16_t val) {
 }
 
 /**
- * Set the sensor mode
+ * Set the sensor mode. The current mode and sample size change when the
+ * first frame of the new mode arrives, see request_mode()
 **/
 void EV3UARTSensor::set_mode(SensorModes mode) {
+  this->set_mode((uint8_t) mode);
+}
+
+/**
+ * Set the sensor mode by number, for sensors other than the Color sensor
+**/
+void EV3UARTSensor::set_mode(uint8_t mode) {
+  this->request_mode(mode);
+}
+
+/**
+ * Ask the sensor to change mode and return at once. The switch completes
+ * when the first DATA frame of the new mode arrives: then the current mode
+ * and sample size change, the latency is recorded and handler is called from
+ * the parser. Frames of the old mode that arrive meanwhile are decoded with
+ * the old mode's format. Returns false for a mode the sensor does not have
+**/
+bool EV3UARTSensor::request_mode(uint8_t mode, EV3UARTModeHandler handler, void* context) {
+  if (mode >= modes || mode >= MAX_MODES || mode_array[mode].decoder == NULL) return false;
+  switch_handler = handler;
+  switch_context = context;
+  switch_target = mode;
+  switch_start = switch_sent = timer->read_us();
+  switch_state = SWITCH_PENDING;
   this->send_select(mode);
-  this->mode = mode;
-  this->num_samples = mode_array[mode]->sets;
+  return true;
+}
+
+/**
+ * Get the state of the last mode switch
+**/
+uint8_t EV3UARTSensor::get_mode_switch() {
+  return switch_state;
+}
+
+/**
+ * Get the time from sending CMD_SELECT to the first frame of the new mode,
+ * for the last completed switch
+**/
+uint32_t EV3UARTSensor::get_switch_latency() {
+  return switch_latency;
+}
+
+
+/**
+ * Set the longest time without a valid DATA frame before the connection is
+ * reset, and a handler called from check_for_data() when that happens. Once
+ * frames arrive the timeout shrinks to WATCHDOG_PERIODS frame periods, see
+ * get_watchdog_timeout(). 0 disables the reset; is_stale() then never
+ * reports a connected sensor as stale
+**/
+void EV3UARTSensor::set_watchdog(uint32_t timeout_us, EV3UARTWatchdogHandler handler, void* context) {
+  watchdog_handler = handler;
+  watchdog_context = context;
+  watchdog_us = timeout_us;
+}
+
+/**
+ * Get the time since the last valid DATA frame, or since data mode started
+ * if there was none yet
+**/
+uint32_t EV3UARTSensor::get_sample_age() {
+  return timer->read_us() - last_frame;
+}
+
+/**
+ * True if the latest sample is not live: the sensor is not in data mode, or
+ * nothing arrived within the watchdog timeout. Computed on each call, so it
+ * is right even if check_for_data() has not run since the sensor went silent
+**/
+bool EV3UARTSensor::is_stale() {
+  if (this->status != DATA_MODE) return true;
+  uint32_t timeout = get_watchdog_timeout();
+  return timeout && get_sample_age() >= timeout;
+}
+
+/**
+ * Get the silence allowed before the sensor is taken as disconnected:
+ * WATCHDOG_PERIODS average frame periods, at least WATCHDOG_MIN_US and at
+ * most the timeout of set_watchdog(). That timeout applies in full until the
+ * frame period of the current mode is known and while a mode switch is
+ * pending, as the sensor may pause to change mode. The period is measured when frames are decoded,
+ * so check_for_data() has to run more often than WATCHDOG_MIN_US
+**/
+uint32_t EV3UARTSensor::get_watchdog_timeout() {
+  uint32_t period = frame_period;
+  if (watchdog_us == 0 || period == 0 || switch_state == SWITCH_PENDING) return watchdog_us;
+  uint32_t timeout = period * WATCHDOG_PERIODS;
+  if (timeout < WATCHDOG_MIN_US) timeout = WATCHDOG_MIN_US;
+  return timeout < watchdog_us ? timeout : watchdog_us;
 }
 
+uint32_t EV3UARTSensor::get_frame_period() {
+  return frame_period;
+}
 
 /**
  * Send mode select command to the sensor
 **/
 void EV3UARTSensor::send_select(uint8_t mode) {
-  uint8_t checksum = 0xff ^ CMD_SELECT;
-  ss->putc(CMD_SELECT);
-  ss->putc(mode);
-  checksum ^= mode;
-  ss->putc(checksum);
+  uint8_t bb[3];
+  bb[0] = CMD_SELECT;
+  bb[1] = mode;
+  bb[2] = this->checksum(bb, 2);
+  send(bb, 3);
 }
 
 /**
  * Send a write command command to the sensor
 **/
 void EV3UARTSensor::send_write(uint8_t* bb, int16_t len) {
-  uint8_t b = CMD_WRITE | (len << CMD_LLL_SHIFT);
-  uint8_t checksum = 0xFF ^ b;
-  ss->putc(b);
-  for(int i=0;i<len;i++) {
-    ss->putc(bb[i]);
-	checksum ^= bb[i];
-  }
-  ss->putc(checksum);
+  uint8_t out[MAX_MESSAGE_SIZE];
+  if (len < 0 || len > MAX_MESSAGE_SIZE - 2) return;
+  out[0] = CMD_WRITE | (len << CMD_LLL_SHIFT);
+  memcpy(out+1, bb, len);
+  out[len+1] = this->checksum(out, len+1);
+  send(out, len+2);
 }
 
 /**
@@ -559,10 +1174,237 @@ int16_t EV3UARTSensor::get_status() {
 }
 
 /**
- * Fetch a sample in the current mode
+ * Copy the latest frame. Safe against the parser running in an interrupt:
+ * the payload, mode and count always come from the same frame
+**/
+void EV3UARTSensor::fetch_latest_frame(EV3UARTFrame &frame) {
+  uint32_t n;
+  do {
+    n = published;
+    EV3UART_BARRIER();
+    frame = latest[n & 1];
+    EV3UART_BARRIER();
+  } while((uint32_t)(writing - n) >= 2);
+}
+
+/**
+ * Copy the latest sample, converted to float
+**/
+void EV3UARTSensor::fetch_latest(EV3UARTSample &sample) {
+  EV3UARTFrame last;
+  fetch_latest_frame(last);
+  last.to_sample(sample);
+}
+
+/**
+ * Fetch a sample in the current mode. Copies as many items as the mode of
+ * the latest frame has, so sample must fit the largest mode used
 **/
 void EV3UARTSensor::fetch_sample(float* sample, int16_t offset) {
-  for(int i=0;i<num_samples;i++) sample[offset+i] = this->value[i];
+  EV3UARTFrame last;
+  fetch_latest_frame(last);
+  last.to_float(sample+offset);
+}
+
+/**
+ * Fetch the latest sample and the mode it was sent in. Returns the number of items
+**/
+int16_t EV3UARTSensor::fetch_sample(float* sample, int16_t offset, uint8_t &mode) {
+  EV3UARTFrame last;
+  fetch_latest_frame(last);
+  mode = last.mode;
+  return last.to_float(sample+offset);
+}
+
+/**
+ * Fetch the latest sample with the items filtered by the filter of its
+ * mode, see set_filter(). Items past FILTER_ITEMS, and all the items of a
+ * mode without a filter, are the raw values. Returns the number of items
+**/
+int16_t EV3UARTSensor::fetch_filtered(float* sample, int16_t offset, uint8_t &mode) {
+  EV3UARTFrame last;
+  float value[FILTER_ITEMS];
+  uint8_t k;
+  uint32_t n;
+  do {
+    n = published;
+    EV3UART_BARRIER();
+    last = latest[n & 1];
+    k = filtered_count[n & 1];
+    for(uint8_t i=0;i<k;i++) value[i] = filtered[n & 1][i];
+    EV3UART_BARRIER();
+  } while((uint32_t)(writing - n) >= 2);
+  mode = last.mode;
+  int16_t count = last.to_float(sample+offset);
+  for(uint8_t i=0;i<k;i++) sample[offset+i] = value[i];
+  return count;
+}
+
+/**
+ * Filter the frames of a mode as they arrive: FILTER_AVERAGE or
+ * FILTER_MEDIAN of the last window frames, FILTER_EMA with weight alpha, or
+ * FILTER_NONE. Up to FILTER_STATES modes are filtered at once, each with its
+ * own state, which is kept while other modes are received. Setting a filter
+ * starts it again. False if the mode is out of range or no state is free.
+ * Set it while the parser is not running, or from the context that runs it
+**/
+bool EV3UARTSensor::set_filter(uint8_t mode, uint8_t type, uint8_t window, float alpha) {
+  if (mode >= MAX_MODES) return false;
+  if (type == FILTER_NONE) {
+    filter_state[mode] = 0xFF;
+    return true;
+  }
+  uint8_t state = filter_state[mode];
+  for(uint8_t s=0;s<FILTER_STATES && state == 0xFF;s++) {
+    bool used = false;
+    for(int i=0;i<MAX_MODES;i++) used = used || filter_state[i] == s;
+    if (!used) state = s;
+  }
+  if (state == 0xFF) return false;
+  EV3UARTFilterConfig config;
+  config.type = type;
+  config.window = window;
+  config.alpha = alpha;
+  filter[state].configure(config);
+  filter_state[mode] = state;
+  return true;
+}
+
+/**
+ * Classify the first three items of the frames of a mode as red, green and
+ * blue with classifier, as they arrive. Set it while the parser is not
+ * running, or from the context that runs it
+**/
+void EV3UARTSensor::set_classifier(EV3UARTColorClassifier* classifier, uint8_t mode) {
+  this->classifier = classifier;
+  classifier_mode = mode;
+}
+
+/**
+ * Colour id of the latest frame and its confidence from 0 to 255. COLOR_NONE
+ * with confidence 0 if the frame was not of the classified mode
+**/
+uint8_t EV3UARTSensor::fetch_color(uint8_t &confidence) {
+  uint8_t id;
+  uint32_t n;
+  do {
+    n = published;
+    EV3UART_BARRIER();
+    id = color[n & 1];
+    confidence = color_confidence[n & 1];
+    EV3UART_BARRIER();
+  } while((uint32_t)(writing - n) >= 2);
+  return id;
+}
+
+/**
+ * Call handler from the parser for every valid DATA frame, after the mode
+ * and any mode switch are updated. The parser runs in check_for_data() and
+ * feed(), so the handler runs in the thread that calls them (the reader
+ * thread with EV3UARTReader), never in the RX interrupt, which only queues
+ * bytes. It may call request_mode(). Set it while the parser is not
+ * running, or from the thread that runs it
+**/
+void EV3UARTSensor::on_frame(EV3UARTFrameHandler handler, void* context) {
+  frame_handler = handler;
+  frame_context = context;
+}
+
+/**
+ * Fetch the latest sample as integers, without floating point unless the
+ * mode sends DATA_F. Returns the number of items
+**/
+int16_t EV3UARTSensor::fetch_sample_int(int32_t* sample, int16_t offset, uint8_t &mode) {
+  EV3UARTFrame last;
+  fetch_latest_frame(last);
+  mode = last.mode;
+  return last.to_int(sample+offset);
+}
+
+/**
+ * Fetch the latest sample converted to SI units with the ranges of its mode.
+ * Returns the number of items
+**/
+int16_t EV3UARTSensor::fetch_sample_si(float* sample, int16_t offset) {
+  uint8_t mode;
+  int16_t n = fetch_sample(sample, offset, mode);
+  mode_array[mode].raw_to_si(sample+offset, sample+offset, n);
+  return n;
+}
+
+/**
+ * Fetch the latest sample converted to percent. Returns the number of items
+**/
+int16_t EV3UARTSensor::fetch_sample_pct(float* sample, int16_t offset) {
+  uint8_t mode;
+  int16_t n = fetch_sample(sample, offset, mode);
+  mode_array[mode].raw_to_pct(sample+offset, sample+offset, n);
+  return n;
+}
+
+/**
+ * Copy up to max samples received since the last call into out, oldest
+ * first. Returns the number copied. Gaps in seq show samples that were lost
+**/
+int16_t EV3UARTSensor::fetch_samples(EV3UARTSample* out, int16_t max) {
+  int16_t n = 0;
+  EV3UARTFrame frame;
+  while(n < max && history.pop(frame)) frame.to_sample(out[n++]);
+  return n;
+}
+
+/**
+ * Copy up to max frames received since the last call, like fetch_samples()
+ * but without converting them
+**/
+int16_t EV3UARTSensor::fetch_frames(EV3UARTFrame* out, int16_t max) {
+  int16_t n = 0;
+  while(n < max && history.pop(out[n])) n++;
+  return n;
+}
+
+/**
+ * Length of the run of samples sent in the same mode as the first
+**/
+static int16_t ev3uart_mode_run(const EV3UARTSample* samples, int16_t n) {
+  int16_t run = 1;
+  while(run < n && samples[run].mode == samples[0].mode) run++;
+  return run;
+}
+
+/**
+ * Fetch samples like fetch_samples(), converted to SI units with the ranges
+ * of the mode each sample was sent in. Each run of samples of one mode is
+ * converted in one call
+**/
+int16_t EV3UARTSensor::fetch_samples_si(EV3UARTSample* out, int16_t max) {
+  int16_t n = fetch_samples(out, max);
+  for(int16_t i=0;i<n;) {
+    int16_t run = ev3uart_mode_run(out+i, n-i);
+    mode_array[out[i].mode].samples_to_si(out+i, run);
+    i += run;
+  }
+  return n;
+}
+
+/**
+ * Fetch samples like fetch_samples(), converted to percent
+**/
+int16_t EV3UARTSensor::fetch_samples_pct(EV3UARTSample* out, int16_t max) {
+  int16_t n = fetch_samples(out, max);
+  for(int16_t i=0;i<n;) {
+    int16_t run = ev3uart_mode_run(out+i, n-i);
+    mode_array[out[i].mode].samples_to_pct(out+i, run);
+    i += run;
+  }
+  return n;
+}
+
+/**
+ * Get the number of samples lost because fetch_samples() was not called often enough
+**/
+uint32_t EV3UARTSensor::get_samples_dropped() {
+  return history.get_overruns();
 }
 
 uint32_t EV3UARTSensor::get_speed(){
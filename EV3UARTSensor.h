@@ -6,8 +6,18 @@
 // Copyright (C) 2014 Lawrie Griffiths
 // Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
 
-#include <mbed.h>
-#include <string>
+#ifndef EV3UARTSENSOR_H
+#define EV3UARTSENSOR_H
+
+#include "EV3UARTPlatform.h"
+#include "EV3UARTRingBuffer.h"
+#include "EV3UARTTransport.h"
+#include "EV3UARTDecoder.h"
+#include "EV3UARTFilter.h"
+#include "EV3UARTColor.h"
+#ifndef EV3UART_HOST
+#include "EV3UARTMbed.h"
+#endif
 
 
 /** Example EV3UARTSensor class.
@@ -24,16 +34,15 @@
  * int main(){
  *
  *  initSystemClock();
- *	sensor.begin(serial3);
- *  sensor.connect(ledg); //sensor.connect(); optional
+ *	sensor.begin(serial3,true); // true: receive bytes from the RX interrupt
+ *  sensor.connect(ledg, 2000000); // give up after 2 s; sensor.connect(); optional
  *
  *  while(true){
  *
  *   sensor.check_for_data();
  *
  *   if(!sw){
- *   	sensor.set_mode(ColColor);
- *   	delay_ms(20);
+ *   	sensor.request_mode(ColColor); // completes when the first ColColor frame arrives
  *   }
  *
  *   sensor.fetch_sample(sample,0);
@@ -54,50 +63,149 @@
 #define   CMD_MODES                     0x49
 #define   CMD_SPEED                     0x52
 #define   CMD_MASK                      0xC0
+#define   CMD_COMMAND                   0x40
 #define   CMD_INFO                      0x80
 #define   CMD_LLL_MASK                  0x38
 #define   CMD_LLL_SHIFT                 3
 #define   CMD_MMM_MASK                  0x07
 #define   CMD_DATA                      0xc0
 #define   CMD_WRITE                     0x44
+#define   CMD_EXT_MODE                  0x46
+
+// Values of the CMD_EXT_MODE byte, added to the mode bits of the next DATA messages
+#define   EXT_MODE_0                    0x00
+#define   EXT_MODE_8                    0x08
+
+// Flag in the INFO type byte of the metadata of modes 8 and above
+#define   INFO_MODE_PLUS_8              0x20
 
 #define   TYPE_COLOR                    29
+#define   TYPE_ULTRASONIC               30
+#define   TYPE_GYRO                     32
+#define   TYPE_IR                       33
 
 // Values for status
 #define RESET 0
 #define STARTED 1
 #define DATA_MODE 2
 
-// Maximum number of modes supported
+// Values for get_mode_switch()
+#define SWITCH_IDLE 0
+#define SWITCH_PENDING 1
+#define SWITCH_DONE 2
+
+// Values returned by connect_step()
+#define CONNECT_PENDING 0
+#define CONNECT_DONE 1
+#define CONNECT_TIMEOUT 2
+
+// Steps of the handshake, in the order they are reached
+#define HANDSHAKE_NONE 0                  // Waiting for CMD_TYPE
+#define HANDSHAKE_TYPE 1                  // CMD_TYPE received
+#define HANDSHAKE_MODES 2                 // CMD_MODES received
+#define HANDSHAKE_SPEED 3                 // CMD_SPEED received
+#define HANDSHAKE_INFO 4                  // INFO messages being received
+#define HANDSHAKE_ACK 5                   // ACK received, or sent early from the cache
+#define HANDSHAKE_DATA 6                  // Speed changed, in data mode
+#define HANDSHAKE_STEPS 7
+
+// Period of the LED blink of connect(DigitalOut&) in microseconds
+#define CONNECT_LED_PERIOD_US 100000
+
+// Maximum number of modes supported. Each one costs sizeof(EV3UARTMode) bytes per sensor
+#ifndef MAX_MODES
 #define MAX_MODES 10
+#endif
 
 // The maximum number of data items in a sample
 #define MAX_DATA_ITEMS 10
 
+// Number of decoded samples kept for fetch_samples() (power of two)
+#ifndef SAMPLE_HISTORY
+#define SAMPLE_HISTORY 16
+#endif
+
 // The time between heartbeats in milliseconds
 #define HEART_BEAT 100
 
-// Set to get message debbugging
-//#define DEBUG
+// The heartbeat period used, a little shorter than HEART_BEAT, in microseconds
+#define HEART_BEAT_PERIOD_US 95000
 
-/**
-* Represent a specific sensor mode
-**/
-using namespace std;
+// The longest message in bytes: command, INFO type, 32 bytes of payload and checksum
+#define MAX_MESSAGE_SIZE 35
 
+// Time after which an unconfirmed CMD_SELECT is sent again, in microseconds
+#define SWITCH_RETRY_US 100000
 
+// Number of corrupted DATA frames in a row, each followed by a
+// resynchronisation, after which the connection is reset
+#define MAX_CONSECUTIVE_ERRORS 16
 
+// Time between acknowledging the sensor and changing speed in microseconds
+#define ACK_DELAY_US 10000
 
+// Time allowed for the first DATA frame after connecting from cached metadata.
+// If none arrives, the cache is ignored and the full handshake is done
+#define CACHE_FALLBACK_US 300000
 
-enum SensorModes{ColReflect,ColAmbient,ColColor,RefRaw,RGBRaw,ColCal};
+// Default time without a valid DATA frame after which the sensor is taken as
+// disconnected and the connection is reset. Used until the frame period is
+// known and while a mode switch is pending, and the longest timeout the frame
+// period can give. 0 disables the watchdog
+#ifndef WATCHDOG_TIMEOUT_US
+#define WATCHDOG_TIMEOUT_US 200000
+#endif
+
+// Once frames arrive, the watchdog allows this many average frame periods of
+// silence, and never less than WATCHDOG_MIN_US
+#ifndef WATCHDOG_PERIODS
+#define WATCHDOG_PERIODS 3
+#endif
+#ifndef WATCHDOG_MIN_US
+#define WATCHDOG_MIN_US 20000
+#endif
+
+// Size of the interrupt receive buffer in bytes (power of two)
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE 256
+#endif
+
+// Size of the transmit queue in bytes (power of two). Each queued message
+// takes its length plus one byte
+#ifndef TX_BUFFER_SIZE
+#define TX_BUFFER_SIZE 64
+#endif
+
+// Storage for a mode name and unit symbol, including the terminating zero
+#define MODE_NAME_SIZE 12
+#define MODE_SYMBOL_SIZE 5
+
+// Set to 0 to compile out the statistics returned by get_stats()
+#ifndef EV3UART_STATS
+#define EV3UART_STATS 1
+#endif
 
+#if EV3UART_STATS
+#define EV3UART_STAT(counter) (stats.counter++)
+#else
+#define EV3UART_STAT(counter) ((void) 0)
+#endif
+
+// Set to get message debbugging
+//#define DEBUG
+
+enum SensorModes{ColReflect,ColAmbient,ColColor,RefRaw,RGBRaw,ColCal};
 
+struct EV3UARTSample;
 
+/**
+* Represent a specific sensor mode. Fixed size, no heap allocation
+**/
 class EV3UARTMode {
 	public:
 		EV3UARTMode();
-		string name;                      // The mode name
-		string symbol;                    // The unit symbol
+		char name[MODE_NAME_SIZE];        // The mode name
+		char symbol[MODE_SYMBOL_SIZE];    // The unit symbol
 		uint8_t sets;                        // The number of samples
 		uint8_t data_type;                   // The data type 0= 8bits, 1=16 bits, 2=32 bits, 3=float
 		uint8_t figures;                     // Number of significant digits
@@ -105,7 +213,88 @@ class EV3UARTMode {
 		float raw_low, raw_high;          // Low and high values for raw data
 		float si_low, si_high;            // Low and high values for SI data
 		float pct_low, pct_high;	      // Low and high values for Percentage values
-		string get_data_type_string();    // Get the data type as a string
+		const char* get_data_type_string(); // Get the data type as a string
+		void set_format(uint8_t sets, uint8_t data_type, uint8_t figures, uint8_t decimals); // Set the format and select the decoder
+		void update_scale();                 // Recalculate the scales after a range changed
+		void raw_to_si(const float* raw, float* si, int16_t n);    // Convert n raw values to SI units
+		void raw_to_pct(const float* raw, float* pct, int16_t n);  // Convert n raw values to percent
+		void samples_to_si(EV3UARTSample* samples, int16_t n);     // Convert n samples of this mode to SI units
+		void samples_to_pct(EV3UARTSample* samples, int16_t n);    // Convert n samples of this mode to percent
+		float si_scale, si_offset;           // si = raw * si_scale + si_offset
+		float pct_scale, pct_offset;         // pct = raw * pct_scale + pct_offset
+		uint8_t items;                       // The number of samples decoded, at most MAX_DATA_ITEMS
+		uint8_t payload_size;                // Length of the payload of a DATA message, 0 if the format is invalid
+		EV3UARTDecoder decoder;              // Decoder for the format, NULL if the format is invalid
+};
+
+// Called when a mode switch is confirmed, with the time it took
+typedef void (*EV3UARTModeHandler)(void* context, uint8_t mode, uint32_t latency_us);
+
+// Called when the watchdog resets a silent sensor, with the time since its last frame
+typedef void (*EV3UARTWatchdogHandler)(void* context, uint32_t silence_us);
+
+class EV3UARTMetadataCache;
+struct EV3UARTMetadata;
+
+/**
+* A decoded sample and when it was received
+**/
+struct EV3UARTSample {
+	uint32_t timestamp_us;                // Timer value when the frame was decoded
+	uint32_t seq;                         // Sequence number, one per valid DATA frame
+	uint8_t mode;                         // The mode the frame was sent in
+	uint8_t count;                        // The number of items in value
+	float value[MAX_DATA_ITEMS];          // The data items
+};
+
+/**
+* A DATA frame as received. The payload is kept in the sensor's format and
+* only converted when asked for, so integer items never have to go
+* through floating point
+**/
+struct EV3UARTFrame {
+	uint32_t timestamp_us;                // Timer value when the frame was received
+	uint32_t seq;                         // Sequence number, one per valid DATA frame
+	uint8_t mode;                         // The mode the frame was sent in
+	uint8_t count;                        // The number of items converted, at most MAX_DATA_ITEMS
+	uint8_t data_type;                    // DATA_8, DATA_16, DATA_32 or DATA_F
+	uint8_t payload[MAX_PAYLOAD];         // The payload, little endian
+	EV3UARTDecoder decoder;               // The float decoder of the mode, selected by set_format()
+	int16_t to_float(float* value) const;     // Convert the items to float. Returns count
+	int16_t to_int(int32_t* value) const;     // Convert the items to int32_t, DATA_F truncated. Returns count
+	void to_sample(EV3UARTSample &sample) const; // Convert to a sample with float values
+};
+
+// Called from the parser for every valid DATA frame, once it is published
+typedef void (*EV3UARTFrameHandler)(void* context, const EV3UARTFrame &frame);
+
+/**
+* Progress of the handshake, see EV3UARTSensor::get_progress()
+**/
+struct EV3UARTProgress {
+	uint8_t state;                        // CONNECT_PENDING, CONNECT_DONE or CONNECT_TIMEOUT
+	uint8_t step;                         // The last HANDSHAKE_ step reached
+	uint8_t info_count;                   // INFO messages received
+	bool from_cache;                      // The INFO messages were skipped using the cache
+	uint32_t elapsed_us;                  // Time since start_connect()
+	uint32_t step_us[HANDSHAKE_STEPS];    // Time from start_connect() to each step, 0 if not reached
+};
+
+/**
+* Link health counters, see EV3UARTSensor::get_stats()
+**/
+struct EV3UARTStats {
+	uint32_t frames;                      // Valid DATA frames decoded
+	uint32_t checksum_errors;             // Messages with a wrong checksum
+	uint32_t resets;                      // Calls to reset()
+	uint32_t watchdog_timeouts;           // Resets because no frame arrived in time
+	uint32_t bytes_discarded;             // Bytes skipped looking for the start of a message
+	uint32_t rx_overruns;                 // Bytes lost because the receive buffer was full
+	uint32_t tx_dropped;                  // Messages not sent because the transmit queue was full
+	uint32_t heartbeats;                  // Heartbeats sent
+	uint32_t check_calls;                 // Calls to check_for_data()
+	uint32_t check_time_us;               // Total time spent in check_for_data()
+	uint32_t check_max_us;                // Longest call to check_for_data()
 };
 
 /**
@@ -115,46 +304,168 @@ class EV3UARTMode {
 class EV3UARTSensor {
 	public:
 		EV3UARTSensor(); // Create the sensor and specify the pins for SoftwareSerial
-		void begin(RawSerial &serial);                                   // Start communicating with the sensor
-		void connect();
-		void connect(DigitalOut &led);
+		void begin(EV3UARTTransport &transport, EV3UARTTimer &timer, bool rx_interrupt = false); // Start communicating over any transport
+#ifndef EV3UART_HOST
+		void begin(RawSerial &serial, bool rx_interrupt = false);       // Start communicating with the sensor
+#endif
+		bool connect(uint32_t timeout_us = 0);               // Wait for data mode, 0 to wait forever. False on timeout
+#ifndef EV3UART_HOST
+		bool connect(DigitalOut &led, uint32_t timeout_us = 0); // Same, blinking led while waiting
+#endif
+		void start_connect(uint32_t timeout_us = 0);         // Start timing a handshake that connect_step() follows
+		uint8_t connect_step();                            // Process received data once, CONNECT_PENDING, _DONE or _TIMEOUT
+		void get_progress(EV3UARTProgress &out);           // Copy the progress of the handshake
 		void end();														// End communication with
-		void check_for_data();                         // Called from Arduino loop to process all data from the sensor
+		void check_for_data();                         // Called from the main loop to process all data from the sensor
+		void feed(const uint8_t* bb, size_t len);       // Process bytes from any source (never blocks)
 		int16_t get_number_of_modes();                     // Number of modes supported
 		void set_mode(SensorModes mode);                       // Set the sensor to the specific mode
+		void set_mode(uint8_t mode);                           // Same, with the mode number of any sensor
+		bool request_mode(uint8_t mode, EV3UARTModeHandler handler = NULL, void* context = NULL); // Switch mode without waiting
+		uint8_t get_mode_switch();                         // SWITCH_IDLE, SWITCH_PENDING or SWITCH_DONE
+		uint32_t get_switch_latency();                     // Microseconds from CMD_SELECT to the first frame of the last switch
+		void set_watchdog(uint32_t timeout_us, EV3UARTWatchdogHandler handler = NULL, void* context = NULL); // 0 disables
+		uint32_t get_sample_age();                         // Microseconds since the last valid DATA frame
+		bool is_stale();                                   // True unless a frame arrived within the watchdog timeout
+		uint32_t get_watchdog_timeout();                   // The timeout in force, from the frame period once known
+		uint32_t get_frame_period();                       // Average time between frames of the current mode, 0 if unknown
 		int16_t get_current_mode();                        // The current sensor mode
 		int16_t sample_size();                             // The number of items in a sample for the current mode
 		void fetch_sample(float* sample, int16_t offset);  // Fetch a sample in the current mode
+		int16_t fetch_sample(float* sample, int16_t offset, uint8_t &mode); // Fetch the latest sample and its mode
+		void fetch_latest(EV3UARTSample &sample);          // Fetch the latest sample with its time and sequence number
+		void fetch_latest_frame(EV3UARTFrame &frame);      // Same, with the payload not converted
+		int16_t fetch_sample_int(int32_t* sample, int16_t offset, uint8_t &mode); // Fetch the latest sample as integers
+		int16_t fetch_filtered(float* sample, int16_t offset, uint8_t &mode); // Fetch the latest sample through its mode's filter
+		bool set_filter(uint8_t mode, uint8_t type, uint8_t window = FILTER_WINDOW, float alpha = 0.25f); // Filter the frames of a mode. False if no state is free
+		void set_classifier(EV3UARTColorClassifier* classifier, uint8_t mode = RGBRaw); // Classify the frames of a mode, NULL to stop
+		uint8_t fetch_color(uint8_t &confidence);          // Colour id of the latest frame, COLOR_NONE if not classified
+		void on_frame(EV3UARTFrameHandler handler, void* context); // Set a handler for every frame, NULL to stop
+		int16_t fetch_sample_si(float* sample, int16_t offset);  // Fetch the latest sample in SI units
+		int16_t fetch_sample_pct(float* sample, int16_t offset); // Fetch the latest sample in percent
+		int16_t fetch_samples(EV3UARTSample* out, int16_t max); // Fetch every sample received since the last call
+		int16_t fetch_frames(EV3UARTFrame* out, int16_t max);   // Same, with the payloads not converted
+		int16_t fetch_samples_si(EV3UARTSample* out, int16_t max);  // Same, converted to SI units
+		int16_t fetch_samples_pct(EV3UARTSample* out, int16_t max); // Same, converted to percent
+		uint32_t get_samples_dropped();                    // Samples lost because the history was full
 		int16_t get_status();                              // Get the status of the connection
 		EV3UARTMode* get_mode(int16_t mode);               // Get the EV3UARTMode object for a specific mode
 		void reset();                                  // Make the sensor reset
 		void send_write(uint8_t* bb, int16_t len);            // Send a WRITE command to the sensor
 		int16_t get_type();                                // Get the LEGO type code for the sensor
 		uint32_t get_speed();
+		uint32_t get_rx_overruns();                        // Bytes lost because the receive buffer was full
+		void heartbeat();                                  // Send a heartbeat now if in data mode
+		void set_external_heartbeat(bool external);        // The owner calls heartbeat() instead of a timer
+		void set_cache(EV3UARTMetadataCache* cache);       // Use cached metadata to reconnect, NULL to stop
+		void get_metadata(EV3UARTMetadata &metadata);      // Copy the metadata received in the handshake
+		bool connected_from_cache();                       // True if the last handshake used the cache
+		void get_stats(EV3UARTStats &out);                 // Copy the link statistics
+		void clear_stats();                                // Set the statistics to zero
 	private:
 		void send_nack();
-	    uint8_t read_byte();                              // Read a byte from the sensor (synchronous)
+		void sync_nack();                                 // Send a heartbeat if due, when the timer has no interrupt
+		static void heartbeat_handler(void* context);
+		static void rx_handler(void* context);
+		static void tx_handler(void* context);
+		bool send(const uint8_t* bb, uint8_t len);        // Queue a whole message for sending
+		void tx_drain();                                  // Send queued bytes while the transport can take them
+		void tx_clear();                                  // Drop everything queued
+		void rx_isr();                                    // Move received bytes into the receive buffer
+		bool rx_available();                              // True if a received byte is waiting
+		uint8_t rx_get();                                 // Take the next received byte
+		void parse_byte(uint8_t b);                       // Add a byte and any bytes to replay to the parser
+		void accept_byte(uint8_t b);                      // Add a byte to the message being collected
+		void resync(uint8_t len);                         // Replay the bytes of a corrupted frame
+		uint8_t message_length(uint8_t cmd);              // Length of the message starting with cmd
+		void process_message(uint8_t len);                // Handle the complete message in msg
+		uint8_t checksum(const uint8_t* bb, int16_t len); // Helper method to calculate a checksum
 		uint32_t get_long(uint8_t* bb, int16_t offset);  // Helper method to get a long value
-		string get_string(uint8_t* bb, int16_t len);          // Helper method to get a String value
+		void get_string(char* s, int16_t size, uint8_t* bb, int16_t len); // Helper method to get a String value
 		float get_float(uint8_t* bb, int16_t len);            // Helper method to get a float value
 		int16_t exp2(int16_t val);                             // Helper method for powers of 2
-		string get_info_type(int16_t val);                 // Helper method to get type of INFO message
-		string get_data_type(int16_t val);                 // Helper method to get the data type as a string
+		const char* get_info_type(int16_t val);            // Helper method to get type of INFO message
+		const char* get_data_type(int16_t val);            // Helper method to get the data type as a string
 		void send_select(uint8_t mode);                   // Send a CMD_SELECT command t change modes
-		int16_t get_int(uint8_t* bb, int16_t offset);             // Helper method to get an int
+		void handshake_step(uint8_t step);                // Record reaching a step of the handshake
+		uint8_t connect_state();                          // CONNECT_PENDING, CONNECT_DONE or CONNECT_TIMEOUT
 		uint32_t speed;                           // The required bit rate of the sensor
-		uint8_t mode;                                     // The current sensor mode
+		uint8_t mode;                                     // The mode of the latest DATA frame
+		uint8_t ext_mode;                                 // Added to the mode bits of DATA messages, from CMD_EXT_MODE
 		uint8_t status;                                   // The current status of the connection
 		uint8_t modes;                                    // The number of modes supported
 		uint8_t views;                                    // The number of views supported
 		uint32_t last_nack;                       // The time of the last heartbeat NACK
 		uint8_t type;                                     // The internal type encoding of the sensor
-		RawSerial *ss;                            // Reference to the SoftwareSerial object
-		int16_t data_errors;                               // Total number of data errors
-		float value[MAX_DATA_ITEMS];                   // The current value
-		int16_t num_samples;                               // The current number of samples
-		EV3UARTMode* mode_array[MAX_MODES] ;           // An array of EV3UARTMode objects
+		EV3UARTTransport *ss;                     // The serial line to the sensor
+		EV3UARTTimer *timer;                      // Time base for heartbeats and the handshake
+#if EV3UART_STATS
+		volatile EV3UARTStats stats;                       // Updated by the parser and the heartbeat
+#endif
+		EV3UARTFrame latest[2];                        // The latest frame and the one being received
+		float filtered[2][FILTER_ITEMS];               // Filtered items of each frame in latest
+		uint8_t filtered_count[2];                     // Number of them, 0 if the mode is not filtered
+		EV3UARTFilter filter[FILTER_STATES];           // States of the filtered modes
+		uint8_t filter_state[MAX_MODES];               // State of each mode's filter, 0xFF for none
+		EV3UARTColorClassifier *classifier;            // Classifier of the RGB mode, or NULL
+		uint8_t classifier_mode;
+		uint8_t color[2];                              // Colour id of each frame in latest
+		uint8_t color_confidence[2];
+		volatile uint32_t writing;                     // Number of the sample being decoded
+		volatile uint32_t published;                   // Number of the latest complete sample, in latest[published & 1]
+		int16_t num_samples;                               // The number of items in the latest DATA frame
+		EV3UARTMode mode_array[MAX_MODES];             // An array of EV3UARTMode objects
+		volatile uint8_t switch_state;                    // SWITCH_IDLE, SWITCH_PENDING or SWITCH_DONE
+		uint8_t switch_target;                            // The mode requested
+		uint32_t switch_start;                            // When CMD_SELECT was first sent
+		uint32_t switch_sent;                             // When CMD_SELECT was last sent
+		uint32_t switch_latency;                          // Duration of the last confirmed switch
+		EV3UARTModeHandler switch_handler;
+		void* switch_context;
+		EV3UARTFrameHandler frame_handler;
+		void* frame_context;
+		uint32_t watchdog_us;                             // Longest silence allowed in data mode, 0 for no limit
+		EV3UARTWatchdogHandler watchdog_handler;
+		void* watchdog_context;
+		volatile uint32_t last_frame;                     // When the last valid DATA frame, or data mode, started
+		volatile uint32_t frame_period;                   // Average time between frames of the same mode, 0 if unknown
+		uint8_t last_frame_mode;                          // Mode of the last frame, 0xFF for none since data mode started
 		uint8_t consecutive_errors;                       // Number of sonsective errors
 		int16_t recent_messages;                           // Number of recent messages
-		Ticker heart;
+		uint32_t sample_seq;                               // Sequence number of the next sample
+		EV3UARTRingBuffer<EV3UARTFrame, SAMPLE_HISTORY> history; // Frames not yet fetched
+		bool heart_attached;                              // Heartbeats are sent from the timer interrupt
+		bool external_heartbeat;                          // Heartbeats are sent by the owner
+		void set_metadata(const EV3UARTMetadata &metadata); // Take type, modes, speed and mode table from the cache
+		void reject_cache();                              // The early ACK failed, stop using it for this type
+		EV3UARTMetadataCache *cache;                      // Metadata of known sensor types, may be NULL
+		bool from_cache;                                  // The handshake was cut short with cached metadata
+		bool skip_cache;                                  // The cache failed, do the next handshake in full
+		uint32_t data_start;                              // When data mode was entered
+		uint32_t connect_start;                           // When start_connect() was called
+		uint32_t connect_timeout;                         // Time allowed by start_connect(), 0 for no limit
+		uint8_t handshake;                                // The last HANDSHAKE_ step reached
+		uint8_t info_count;                               // INFO messages in this handshake
+		uint32_t handshake_us[HANDSHAKE_STEPS];           // Time from connect_start to each step
+		bool rx_interrupt;                                // Bytes arrive through rx_isr() and rx_buffer
+		EV3UARTRingBuffer<uint8_t, RX_BUFFER_SIZE> rx_buffer; // Bytes received in interrupt mode
+		EV3UARTRingBuffer<uint8_t, TX_BUFFER_SIZE> tx_buffer; // Messages to send, each preceded by its length
+		bool tx_interrupt;                                // tx_buffer is drained by the TX interrupt
+		volatile bool tx_busy;                            // tx_drain() is running
+		volatile bool nack_due;                           // A heartbeat goes out before the next message
+		uint8_t tx_remaining;                             // Bytes of the current message still to send
+		uint8_t msg[MAX_MESSAGE_SIZE];                    // The message being collected
+		uint8_t msg_len;                                  // Its expected length, 0 while waiting for a command
+		uint8_t msg_pos;                                  // Number of bytes collected so far
+		uint8_t replay[MAX_MESSAGE_SIZE];                 // Bytes of a corrupted frame to parse again
+		uint8_t replay_len;
+		uint8_t replay_pos;                               // Next byte to parse again
+		bool ack_pending;                                 // ACK sent, waiting to change speed
+		uint32_t ack_time;                                // When the ACK was sent
+#ifndef EV3UART_HOST
+		EV3UARTMbedTransport mbed_transport;              // Used by begin(RawSerial&)
+		EV3UARTMbedTimer mbed_timer;
+#endif
 };
+
+#endif
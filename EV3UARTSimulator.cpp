@@ -0,0 +1,315 @@
+// EV3UARTSimulator.cpp
+//
+// A simulated EV3 colour sensor on a simulated serial line.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#include "EV3UARTSimulator.h"
+#include "EV3UARTSensor.h"
+
+/**
+* Metadata of one mode of the simulated sensor
+**/
+struct SimMode {
+  const char* name;
+  const char* symbol;
+  uint8_t sets;
+  uint8_t data_type;
+  uint8_t figures;
+  uint8_t decimals;
+  float raw_low, raw_high;
+  float pct_low, pct_high;
+  float si_low, si_high;
+};
+
+// The modes reported by a LEGO EV3 colour sensor
+static const SimMode sim_modes[] = {
+  {"COL-REFLECT", "pct", 1, 0, 3, 0, 0, 100, 0, 100, 0, 100},
+  {"COL-AMBIENT", "pct", 1, 0, 3, 0, 0, 100, 0, 100, 0, 100},
+  {"COL-COLOR", "col", 1, 0, 2, 0, 0, 8, 0, 100, 0, 8},
+  {"REF-RAW", "", 2, 1, 4, 0, 0, 1020, 0, 100, 0, 1020},
+  {"RGB-RAW", "", 3, 1, 4, 0, 0, 1020, 0, 100, 0, 1020},
+  {"COL-CAL", "", 4, 1, 5, 0, 0, 65535, 0, 100, 0, 65535},
+};
+
+#define SIM_MODES (sizeof(sim_modes)/sizeof(sim_modes[0]))
+#define SIM_SPEED 57600
+
+// Bytes in each data type
+static const uint8_t sim_type_size[] = {1, 2, 4, 4};
+
+EV3UARTSimulator::EV3UARTSimulator() {
+  now = 0;
+  frame_period = 10000;
+  error_rate = 0;
+  random = 1;
+  bit_errors = 0;
+  frames_sent = 0;
+  heartbeats = 0;
+  for(int i=0;i<8;i++) value[i] = 0;
+  restart();
+}
+
+/**
+ * Start the handshake again at 2400 baud, as a sensor does after power up
+**/
+void EV3UARTSimulator::restart() {
+  line.clear();
+  line_baud = 2400;
+  line_free = now;
+  state = SIM_HANDSHAKE;
+  mode = 0;
+  acked = false;
+  host_len = 0;
+  host_pos = 0;
+
+  uint8_t bb[4];
+  bb[0] = TYPE_COLOR;
+  send_message(CMD_TYPE, bb, 1, now);
+  bb[0] = SIM_MODES - 1;
+  bb[1] = 3;
+  send_message(CMD_MODES, bb, 2, now);
+  uint32_t speed = SIM_SPEED;
+  for(int i=0;i<4;i++) bb[i] = (uint8_t) (speed >> (8*i));
+  send_message(CMD_SPEED, bb, 4, now);
+
+  // Modes are described from the highest to zero
+  for(int m=SIM_MODES-1;m>=0;m--) {
+    const SimMode &sm = sim_modes[m];
+    send_info(m, 0, (const uint8_t*) sm.name, strlen(sm.name));
+    send_float_pair(m, 1, sm.raw_low, sm.raw_high);
+    send_float_pair(m, 2, sm.pct_low, sm.pct_high);
+    send_float_pair(m, 3, sm.si_low, sm.si_high);
+    send_info(m, 4, (const uint8_t*) sm.symbol, strlen(sm.symbol));
+    bb[0] = sm.sets;
+    bb[1] = sm.data_type;
+    bb[2] = sm.figures;
+    bb[3] = sm.decimals;
+    send_info(m, 0x80, bb, 4);
+  }
+  send_byte(BYTE_ACK, now);
+  state = SIM_WAIT_ACK;
+}
+
+/**
+ * Disconnect the sensor. Bytes still on the line are lost and nothing more
+ * is sent until restart()
+**/
+void EV3UARTSimulator::unplug() {
+  line.clear();
+  state = SIM_UNPLUGGED;
+}
+
+void EV3UARTSimulator::advance_us(uint32_t us) {
+  now += us;
+  if (state != SIM_DATA) return;
+  // Queue every frame due by now. With no frame period the line is kept busy
+  while (line.size() + MAX_MESSAGE_SIZE < line.capacity()) {
+    uint32_t due = frame_period ? next_frame : line_free;
+    if ((int32_t) (due - now) > 0) break;
+    send_data(due);
+    next_frame += frame_period;
+  }
+}
+
+void EV3UARTSimulator::set_frame_period_us(uint32_t us) {
+  frame_period = us;
+}
+
+void EV3UARTSimulator::set_value(uint8_t index, int32_t value) {
+  if (index < 8) this->value[index] = value;
+}
+
+/**
+ * Corrupt bytes sent in data mode. Each byte has per_million chances in a
+ * million of having one bit flipped. The same seed gives the same errors
+**/
+void EV3UARTSimulator::set_bit_errors(uint32_t per_million, uint32_t seed) {
+  error_rate = per_million;
+  random = seed ? seed : 1;
+}
+
+uint32_t EV3UARTSimulator::get_bit_errors() {
+  return bit_errors;
+}
+
+uint8_t EV3UARTSimulator::get_state() {
+  return state;
+}
+
+uint8_t EV3UARTSimulator::get_mode() {
+  return mode;
+}
+
+uint32_t EV3UARTSimulator::get_frames_sent() {
+  return frames_sent;
+}
+
+uint32_t EV3UARTSimulator::get_heartbeats() {
+  return heartbeats;
+}
+
+/**
+ * The host changed speed. Data starts once the host has acknowledged and
+ * switched to the data speed. Going back to 2400 baud restarts the handshake
+**/
+void EV3UARTSimulator::baud(uint32_t rate) {
+  if (state == SIM_WAIT_ACK && acked && rate == SIM_SPEED) {
+    line.clear();
+    line_baud = rate;
+    line_free = now;
+    next_frame = now;
+    state = SIM_DATA;
+  } else if (state == SIM_DATA && rate == 2400) {
+    restart();
+  }
+}
+
+bool EV3UARTSimulator::readable() {
+  Byte b = Byte();
+  if (!line.peek(b)) return false;
+  return (int32_t) (b.at - now) <= 0;
+}
+
+/**
+ * Move the virtual clock forward until a byte arrives, at most timeout_us
+**/
+bool EV3UARTSimulator::wait_readable(uint32_t timeout_us) {
+  while (!readable() && timeout_us > 0) {
+    uint32_t step = timeout_us < 100 ? timeout_us : 100;
+    advance_us(step);
+    timeout_us -= step;
+  }
+  return readable();
+}
+
+uint8_t EV3UARTSimulator::getc() {
+  Byte b = Byte();
+  line.pop(b);
+  return b.b;
+}
+
+bool EV3UARTSimulator::writeable() {
+  return true;
+}
+
+/**
+ * Receive a byte from the host
+**/
+void EV3UARTSimulator::putc(uint8_t b) {
+  if (host_len == 0) {
+    if (b == BYTE_ACK || b == BYTE_NACK) {
+      host_msg[0] = b;
+      host_message(1);
+      return;
+    }
+    if ((b & CMD_MASK) != CMD_COMMAND) return;
+    host_len = 2 + (1 << ((b & CMD_LLL_MASK) >> CMD_LLL_SHIFT));
+    host_pos = 0;
+  }
+  host_msg[host_pos++] = b;
+  if (host_pos == host_len) {
+    uint8_t len = host_len;
+    host_len = 0;
+    host_message(len);
+  }
+}
+
+void EV3UARTSimulator::host_message(uint8_t len) {
+  uint8_t cmd = host_msg[0];
+  if (cmd == BYTE_ACK) {
+    if (state == SIM_WAIT_ACK) acked = true;
+  } else if (cmd == BYTE_NACK) {
+    heartbeats++;
+  } else if (cmd == CMD_SELECT && state == SIM_DATA) {
+    uint8_t checksum = 0xff;
+    for(int i=0;i<len-1;i++) checksum ^= host_msg[i];
+    if (checksum == host_msg[len-1] && host_msg[1] < SIM_MODES) mode = host_msg[1];
+  }
+}
+
+uint32_t EV3UARTSimulator::read_us() {
+  return now;
+}
+
+void EV3UARTSimulator::delay_ms(uint32_t ms) {
+  advance_us(ms * 1000);
+}
+
+/**
+ * Put a byte on the line. It is received one character time after the
+ * line is free and the byte is ready
+**/
+void EV3UARTSimulator::send_byte(uint8_t b, uint32_t ready) {
+  uint32_t start = (int32_t) (ready - line_free) > 0 ? ready : line_free;
+  if (error_rate && state == SIM_DATA) {
+    random = random * 1664525 + 1013904223;
+    if ((random >> 8) % 1000000 < error_rate) {
+      b ^= 1 << ((random >> 4) & 7);
+      bit_errors++;
+    }
+  }
+  Byte lb;
+  lb.b = b;
+  lb.at = start + 10000000 / line_baud;
+  line_free = lb.at;
+  line.push(lb);
+}
+
+/**
+ * Send a message, padding the payload to a power of two and adding the checksum
+**/
+void EV3UARTSimulator::send_message(uint8_t cmd, const uint8_t* bb, uint8_t len, uint32_t ready) {
+  uint8_t lll = 0;
+  while ((1 << lll) < len) lll++;
+  cmd |= lll << CMD_LLL_SHIFT;
+  uint8_t checksum = 0xff ^ cmd;
+  send_byte(cmd, ready);
+  for(int i=0;i<(1 << lll);i++) {
+    uint8_t b = i < len ? bb[i] : 0;
+    checksum ^= b;
+    send_byte(b, ready);
+  }
+  send_byte(checksum, ready);
+}
+
+void EV3UARTSimulator::send_info(uint8_t mode, uint8_t type, const uint8_t* bb, uint8_t len) {
+  uint8_t lll = 0;
+  while ((1 << lll) < len) lll++;
+  uint8_t cmd = CMD_INFO | (lll << CMD_LLL_SHIFT) | mode;
+  uint8_t checksum = 0xff ^ cmd ^ type;
+  send_byte(cmd, now);
+  send_byte(type, now);
+  for(int i=0;i<(1 << lll);i++) {
+    uint8_t b = i < len ? bb[i] : 0;
+    checksum ^= b;
+    send_byte(b, now);
+  }
+  send_byte(checksum, now);
+}
+
+void EV3UARTSimulator::send_float_pair(uint8_t mode, uint8_t type, float low, float high) {
+  uint8_t bb[8];
+  memcpy(bb, &low, 4);
+  memcpy(bb+4, &high, 4);
+  send_info(mode, type, bb, 8);
+}
+
+/**
+ * Send one DATA frame with the configured values in the current mode's format
+**/
+void EV3UARTSimulator::send_data(uint32_t ready) {
+  const SimMode &sm = sim_modes[mode];
+  uint8_t size = sim_type_size[sm.data_type];
+  uint8_t bb[32];
+  for(int i=0;i<sm.sets;i++) {
+    int32_t v = value[i];
+    if (sm.data_type == 3) {
+      float f = (float) v;
+      memcpy(&v, &f, 4);
+    }
+    for(int j=0;j<size;j++) bb[i*size+j] = (uint8_t) (v >> (8*j));
+  }
+  send_message(CMD_DATA | mode, bb, sm.sets * size, ready);
+  frames_sent++;
+}
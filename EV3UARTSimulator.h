@@ -0,0 +1,98 @@
+// EV3UARTSimulator.h
+//
+// A simulated EV3 colour sensor on a simulated serial line. It plays the
+// TYPE/MODES/SPEED/INFO/ACK handshake and then streams DATA frames, so the
+// library can be run and measured without hardware.
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTSIMULATOR_H
+#define EV3UARTSIMULATOR_H
+
+#include "EV3UARTTransport.h"
+#include "EV3UARTRingBuffer.h"
+
+// Number of bytes the simulated line can hold
+#ifndef SIM_BUFFER_SIZE
+#define SIM_BUFFER_SIZE 512
+#endif
+
+// Values for the simulator state
+#define SIM_HANDSHAKE 0
+#define SIM_WAIT_ACK 1
+#define SIM_DATA 2
+#define SIM_UNPLUGGED 3
+
+/**
+* Simulated colour sensor with its own virtual clock. Time only moves when
+* advance_us() or delay_ms() is called, so runs are repeatable.
+*
+* @code
+* EV3UARTSimulator sim;
+* EV3UARTSensor sensor;
+* sensor.begin(sim, sim);
+* while (sensor.get_status() != DATA_MODE) {
+*   sim.advance_us(1000);
+*   sensor.check_for_data();
+* }
+* @endcode
+**/
+class EV3UARTSimulator : public EV3UARTTransport, public EV3UARTTimer {
+	public:
+		EV3UARTSimulator();
+		void restart();                                // Start the handshake again, also after unplug()
+		void unplug();                                 // Stop sending, as if the cable was pulled out
+		void advance_us(uint32_t us);                  // Move the virtual clock forward
+		void set_frame_period_us(uint32_t us);         // Time between DATA frames, 0 for back to back
+		void set_value(uint8_t index, int32_t value);  // Set a data item sent in every frame
+		void set_bit_errors(uint32_t per_million, uint32_t seed = 1); // Flip a bit in this many DATA mode bytes per million
+		uint32_t get_bit_errors();                     // Number of bits flipped so far
+		uint8_t get_state();                           // SIM_HANDSHAKE, SIM_WAIT_ACK, SIM_DATA or SIM_UNPLUGGED
+		uint8_t get_mode();                            // The mode being streamed
+		uint32_t get_frames_sent();                    // Number of DATA frames sent, across restarts
+		uint32_t get_heartbeats();                     // Number of NACKs received from the host, across restarts
+
+		// EV3UARTTransport
+		void baud(uint32_t rate);
+		bool readable();
+		uint8_t getc();
+		bool writeable();
+		void putc(uint8_t b);
+		bool wait_readable(uint32_t timeout_us);
+
+		// EV3UARTTimer
+		uint32_t read_us();
+		void delay_ms(uint32_t ms);
+
+	private:
+		struct Byte {
+			uint8_t b;                                 // The byte
+			uint32_t at;                               // When its stop bit has been received
+		};
+		void send_byte(uint8_t b, uint32_t ready);     // Put a byte on the line
+		void send_message(uint8_t cmd, const uint8_t* bb, uint8_t len, uint32_t ready);
+		void send_info(uint8_t mode, uint8_t type, const uint8_t* bb, uint8_t len);
+		void send_float_pair(uint8_t mode, uint8_t type, float low, float high);
+		void send_data(uint32_t ready);                // Send one DATA frame for the current mode
+		void host_message(uint8_t len);                // Handle a complete message from the host
+		EV3UARTRingBuffer<Byte, SIM_BUFFER_SIZE> line; // Bytes on their way to the host
+		uint32_t now;                                  // The virtual clock
+		uint32_t line_free;                            // When the line can start another byte
+		uint32_t line_baud;                            // Current bit rate of the line
+		uint32_t frame_period;
+		uint32_t next_frame;                           // When the next DATA frame is due
+		uint8_t state;
+		uint8_t mode;
+		bool acked;                                    // The host acknowledged the handshake
+		int32_t value[8];
+		uint32_t frames_sent;
+		uint32_t heartbeats;
+		uint32_t error_rate;                           // Bytes with a flipped bit per million
+		uint32_t random;                               // State of the error generator
+		uint32_t bit_errors;
+		uint8_t host_msg[35];                          // Message being received from the host
+		uint8_t host_len;
+		uint8_t host_pos;
+};
+
+#endif
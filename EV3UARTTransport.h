@@ -0,0 +1,51 @@
+// EV3UARTTransport.h
+//
+// Byte transport and time base used by EV3UARTSensor. Implementations exist
+// for mbed (EV3UARTMbed.h), Linux serial ports (EV3UARTLinux.h) and a
+// simulated colour sensor (EV3UARTSimulator.h).
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifndef EV3UARTTRANSPORT_H
+#define EV3UARTTRANSPORT_H
+
+#include "EV3UARTPlatform.h"
+
+// Function called from interrupt or timer context with the context it was attached with
+typedef void (*EV3UARTHandler)(void* context);
+
+/**
+* A serial line to one sensor
+**/
+class EV3UARTTransport {
+	public:
+		virtual ~EV3UARTTransport() {}
+		virtual void baud(uint32_t rate) = 0;          // Change the bit rate
+		virtual bool readable() = 0;                   // True if a received byte is waiting
+		virtual uint8_t getc() = 0;                    // Take a received byte. Only after readable()
+		virtual bool writeable() = 0;                  // True if a byte can be sent without waiting
+		virtual void putc(uint8_t b) = 0;              // Send a byte
+		// Call handler from the RX interrupt. Returns false if not supported
+		virtual bool attach_rx(EV3UARTHandler handler, void* context) { return false; }
+		// Call handler from the TX interrupt while it is enabled. Returns false if not supported
+		virtual bool attach_tx(EV3UARTHandler handler, void* context) { return false; }
+		virtual void enable_tx(bool enable) {}         // Enable the TX interrupt while there is data to send
+		// Block until a byte is readable or timeout_us passes. Returns readable().
+		// Transports that cannot block return at once
+		virtual bool wait_readable(uint32_t timeout_us) { return readable(); }
+};
+
+/**
+* A microsecond time base with an optional periodic interrupt
+**/
+class EV3UARTTimer {
+	public:
+		virtual ~EV3UARTTimer() {}
+		virtual uint32_t read_us() = 0;                // Free running microsecond counter
+		virtual void delay_ms(uint32_t ms) = 0;        // Wait, safe to use with attach_us()
+		// Call handler every period_us. Returns false if not supported
+		virtual bool attach_us(EV3UARTHandler handler, void* context, uint32_t period_us) { return false; }
+		virtual void detach() {}                       // Stop calling the periodic handler
+};
+
+#endif
@@ -0,0 +1,54 @@
+// ev3uart_bench.cpp
+//
+// Benchmark suite of the library for Linux hosts. Writes the results as
+// JSON to the file given, or to stdout, to compare them between releases.
+// With --check it runs the bit error measurement instead and exits with 1
+// if frames are lost beyond what the flipped bits explain:
+//
+// g++ -O2 -pthread -DEV3UART_HOST -I. bench/ev3uart_bench.cpp EV3UART*.cpp -o ev3uart_bench
+// ./ev3uart_bench --check
+//
+// Modified and adapted for use in mbed by Federico Pinna(fedepinna13@gmail.com)
+
+#ifdef EV3UART_HOST
+
+#include "EV3UARTBench.h"
+#include <string.h>
+
+/**
+ * Stream with 0, 100, 1000 and 10000 flipped bits per million bytes and
+ * check that frames are sent, that at most 3 frames are lost for every 2
+ * bits flipped (a bit error costs the frame it hits and at times the next
+ * one while the parser resynchronises) and that the lower rates cause no
+ * reset. True if every rate passes
+**/
+static bool check_noise() {
+  static const uint32_t error_rates[] = {0, 100, 1000, 10000};
+  bool passed = true;
+  for(int i=0;i<4;i++) {
+    EV3UARTNoiseBench n;
+    n.errors_per_million = error_rates[i];
+    n.duration_us = 20000000;
+    bool ok = EV3UARTBench::noise(n) && n.frames_sent > 0 && n.frames_lost * 2 <= n.bit_errors * 3 &&
+              (n.resets == 0 || n.errors_per_million > 1000);
+    printf("%s %5lu ppm: %lu bits flipped, %lu of %lu frames lost, %lu resets\n", ok ? "ok  " : "FAIL",
+           (unsigned long) n.errors_per_million, (unsigned long) n.bit_errors, (unsigned long) n.frames_lost,
+           (unsigned long) n.frames_sent, (unsigned long) n.resets);
+    if (!ok) passed = false;
+  }
+  return passed;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--check") == 0) return check_noise() ? 0 : 1;
+  FILE* out = stdout;
+  if (argc > 1 && (out = fopen(argv[1], "w")) == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  EV3UARTBench::report(out);
+  if (out != stdout) fclose(out);
+  return 0;
+}
+
+#endif